@@ -3,6 +3,12 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <string>
+#include <functional>
+#include <memory>
+#include <cstdint>
+#include "SharedMemoryRing.hpp"
+#include "ExperimentStore.hpp"
 #include <Eigen/Dense>
 
 namespace axes_ident
@@ -37,19 +43,49 @@ public:
     enum Storage
     {
         MULTIPLE = (1u << 0),
-        SINGLE   = (1u << 1)
+        SINGLE   = (1u << 1),
+        COMPACT  = (1u << 2)
     };
 
 private:
+    /**
+     * @brief State kept between calls to \ref followFile.
+     */
+    struct FollowState
+    {
+        std::string fname;
+        std::streamoff offset_data;
+        std::streamoff offset;
+        std::string first_line;
+        Eigen::RowVectorXd last_row;
+        Eigen::RowVectorXd last_valid_row;
+        int max_index;
+        bool stopped;
+    };
+
     char delim;
     unsigned int header_size, n_joints;
     std::vector<unsigned int> filter;
     Data data;
     std::vector<Data> data_by_joint;
+    // Rows in use, the matrices grow geometrically when rows are appended
+    unsigned int n_rows_data;
+    std::vector<unsigned int> n_rows_by_joint;
+    ExperimentStore store;
+    double tol_quantization;
+    unsigned int keyframe_interval;
     bool ok_data;
     double tol_max_stall_movement;
     double tol_min_movement;
     unsigned short mask_storage;
+    FollowState follow;
+    std::shared_ptr<SharedMemoryRing> ring;
+    std::uint64_t ring_sequence;
+    unsigned long n_lost_samples;
+    Data ring_rows;
+    // Scratch of _appendRows, kept so that appending rows does not allocate memory
+    std::vector<int> scratch_indices;
+    std::vector<unsigned int> scratch_n_experiments;
 
     /**
      * @brief Jumps through the data file header lines.
@@ -104,6 +140,29 @@ private:
      */
     bool _configureDataMatrices();
 
+    /**
+     * @brief Sets the rows in use to the size of the data matrices.
+     */
+    void _setRowsInUse();
+
+    /**
+     * @brief Index of the joint that moved from last_row to row, or \ref DataParser.INDEX_INVALID.
+     */
+    static int _movingJointIndex(const Eigen::Ref<const Eigen::RowVectorXd> &last_row,
+        const Eigen::Ref<const Eigen::RowVectorXd> &row, double tol_max_stall_movement, double tol_min_movement);
+
+    /**
+     * @brief Classifies rows appended to a followed file or ring and extends the storage with them.
+     * 
+     * @param rows new rows, without the moving joint index.
+     */
+    void _appendRows(const Eigen::Ref<const Data> &rows);
+
+    /**
+     * @brief Checks whether the followed file still starts with the data that was already parsed.
+     */
+    bool _isSameFollowedFile(std::ifstream &file, std::streamoff file_size);
+
 public:
     /**
      * @brief Construct a new Data Parser object.
@@ -143,6 +202,16 @@ public:
         tol_min_movement = tol;
     }
 
+    inline double getToleranceStall() const
+    {
+        return tol_max_stall_movement;
+    }
+
+    inline double getToleranceMinMovement() const
+    {
+        return tol_min_movement;
+    }
+
     /**
      * @brief Reads a data file and stores the results internally.
      * 
@@ -153,6 +222,67 @@ public:
      */
     bool readFile(const std::string &fname);
 
+    /**
+     * @brief Reads a data file that is still being written, parsing only what was appended since the last call.
+     * 
+     * The first call, or a call with a different file name, reads the whole file. Later calls only parse
+     * the complete lines appended since then; a partial trailing line is left for the next call.
+     * If the file was truncated or replaced, it is read again from the start.
+     * As in \ref readFile, parsing stops at the first empty line and anything appended after it is ignored.
+     * Unlike \ref readFile, the data is kept while it is not yet valid, e.g., before every joint moved.
+     * 
+     * @param fname full file name.
+     * @return true if the data read so far is valid.
+     * @return false if it is not valid yet or the file could not be read.
+     * @see check, readFile
+     */
+    bool followFile(const std::string &fname);
+
+    /**
+     * @brief Maps a shared memory ring written by an acquisition process.
+     * 
+     * Samples still in the ring are consumed by the next call to \ref readSharedMemory.
+     * The filter and delimiter settings do not apply to ring samples.
+     * 
+     * @param name POSIX shared memory object name.
+     * @return true if the ring was mapped.
+     * @return false if it fails or the library was built without shared memory support, which needs POSIX.
+     * @see SharedMemoryRing
+     */
+    bool openSharedMemory(const std::string &name);
+
+    /**
+     * @brief Consumes the samples published to the shared memory ring since the last call.
+     * 
+     * Each sample is copied from the mapped memory to staging rows, allocated once for the capacity
+     * of the ring, and validated with its sequence number as in \ref SharedMemoryRing::read. The
+     * staged samples are then appended to the storage as in \ref followFile. Samples overwritten
+     * before or while being read are skipped and counted, see \ref getNLostSamples.
+     * 
+     * If the producer restarted, the new ring is opened and the data is read again from the start.
+     * If the producer is gone, the ring is unmapped and \ref openSharedMemory has to be called again.
+     * 
+     * @return true if the data read so far is valid.
+     * @return false if it is not valid yet or no ring is mapped.
+     */
+    bool readSharedMemory();
+
+    /**
+     * @brief Unmaps the shared memory ring, keeping the data read from it.
+     */
+    inline void closeSharedMemory()
+    {
+        ring.reset();
+    }
+
+    /**
+     * @brief Number of ring samples overwritten by the producer before they could be read.
+     */
+    inline unsigned long getNLostSamples() const
+    {
+        return n_lost_samples;
+    }
+
     /**
      * @brief Reads a data matrix and stores the results internally.
      * 
@@ -163,6 +293,22 @@ public:
      */
     bool readData(const Data &data);
 
+    /**
+     * @brief Configures the encoding of the compact storage, see \ref ExperimentStore.
+     * 
+     * Applies to the data read afterwards.
+     * 
+     * @param tol_quantization largest error allowed on the joints that did not move, zero to keep them exactly.
+     * @param keyframe_interval number of experiments between records holding every joint angle.
+     */
+    inline void setCompactStorage(double tol_quantization,
+        unsigned int keyframe_interval = ExperimentStore::DEFAULT_KEYFRAME_INTERVAL)
+    {
+        this->_validateTolerance(tol_quantization);
+        this->tol_quantization = tol_quantization;
+        this->keyframe_interval = keyframe_interval;
+    }
+
     /**
      * @brief Sets the delimiter character (besides empty spaces) that separates the values in the data file.
      * 
@@ -211,28 +357,46 @@ public:
     {
         data.resize(0,0);
         data_by_joint.clear();
+        n_rows_data = 0;
+        n_rows_by_joint.clear();
+        store.reset(0, tol_quantization, keyframe_interval);
         n_joints = 0;
         ok_data = false;
+        follow = FollowState();
     }
 
     /**
      * @brief Matrix with data read from file.
      * 
-     * @return constant reference to the data matrix
+     * @return view of the data matrix, valid until data is read or appended
      */
-    inline const Data & getData() const
+    inline Eigen::Ref<const Data> getData() const
     {
-        return data;
+        return data.topRows(n_rows_data);
     }
 
     /**
      * @brief Get the Data By Joint object
      * 
-     * @return constant reference to the vector containing data matrices for each joint
+     * @return views of the data matrices for each joint, valid until data is read or appended
+     */
+    inline std::vector<Eigen::Ref<const Data>> getDataByJoint() const
+    {
+        std::vector<Eigen::Ref<const Data>> views;
+        views.reserve(data_by_joint.size());
+        for (unsigned int k = 0; k < data_by_joint.size(); ++k)
+            views.emplace_back(data_by_joint[k].topRows(n_rows_by_joint[k]));
+        return views;
+    }
+
+    /**
+     * @brief Experiments in compact form, only filled with the \ref Storage.COMPACT storage type.
+     * 
+     * @return constant reference to the experiment store
      */
-    inline const std::vector<Data> & getDataByJoint() const
+    inline const ExperimentStore & getExperimentStore() const
     {
-        return data_by_joint;
+        return store;
     }
 
     /**
@@ -248,8 +412,7 @@ public:
      */
     inline void setStorageMask(unsigned short mask)
     {
-        if ( !this->_hasStorageMask(Storage::SINGLE) &&
-             !this->_hasStorageMask(Storage::MULTIPLE) )
+        if ((mask & (Storage::SINGLE | Storage::MULTIPLE | Storage::COMPACT)) == 0)
         {
             std::cerr << "[Error] Invalid storage mask. DataParser::Storage enum for valid types." << std::endl;
             return;
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "Identification.hpp"
+#include <Eigen/Dense>
+
+namespace axes_ident
+{
+
+class ExcitationPlanner
+{
+public:
+    /**
+     * @brief Default largest move amplitude, where \ref HelperFunctions::axisFromRot is least sensitive to noise.
+     */
+    constexpr static double DEFAULT_MAX_AMPLITUDE = 1.5707963267948966;
+
+    /**
+     * @brief Default number of amplitudes tried for each joint.
+     */
+    const static unsigned int DEFAULT_N_AMPLITUDES = 8;
+
+    /**
+     * @brief Default prior information on each axis coordinate.
+     * 
+     * Keeps the information matrix invertible when some joint has no experiments yet.
+     */
+    constexpr static double DEFAULT_PRIOR_INFORMATION = 1e-3;
+
+    /**
+     * @brief Move recommended by the planner.
+     */
+    struct Move
+    {
+        /**
+         * @brief Joint to move, or \ref DataParser.INDEX_INVALID if no move is feasible.
+         */
+        int joint;
+
+        /**
+         * @brief Signed amount the joint should move, all other joints standing still.
+         */
+        double delta_angle;
+
+        /**
+         * @brief Predicted uncertainty of the axes after the move.
+         * @see computeUncertainty
+         */
+        double uncertainty;
+    };
+
+private:
+    const Identification &ident;
+    unsigned int n_joints;
+    Eigen::VectorXd lower_limits, upper_limits;
+    double max_amplitude;
+    double tol_min_movement;
+    double tol_max_stall_movement;
+    double prior_information;
+    unsigned int n_amplitudes;
+
+    Identification::Workspace workspace;
+    Eigen::MatrixXd information, information_candidate;
+    Eigen::Matrix<double, 9, Eigen::Dynamic> J;
+    Eigen::LDLT<Eigen::MatrixXd> ldlt;
+
+    /**
+     * @brief Computes the information of the experiments performed so far, including the prior.
+     * 
+     * @return estimate of the measurement noise variance
+     */
+    double _computeInformation(const Eigen::Matrix<double, 3, Eigen::Dynamic> &axes, bool start_from_last);
+
+    /**
+     * @brief Trace of the inverse of the given information matrix.
+     */
+    double _traceInverse(const Eigen::MatrixXd &information);
+
+public:
+    /**
+     * @brief Construct a new Excitation Planner object.
+     * 
+     * @param ident identification holding the experiments performed so far, it must outlive the planner
+     * @param parser parser that will classify the planned moves, whose tolerances are copied, see \ref setTolerances
+     */
+    ExcitationPlanner(const Identification &ident, const DataParser &parser);
+
+    /**
+     * @brief Limits of the joint angles, moves that would leave them are never recommended.
+     */
+    void setJointLimits(const Eigen::VectorXd &lower, const Eigen::VectorXd &upper);
+
+    /**
+     * @brief Largest amplitude of a single move, limited to pi.
+     */
+    void setMaxAmplitude(double val);
+
+    /**
+     * @brief Copies the movement tolerances of the parser that classifies the experiments.
+     * 
+     * Planned moves assume that the joints told to stand still drift by at most the stall tolerance,
+     * see \ref DataParser::setToleranceStall. Moves that the parser could discard as invalid, i.e.,
+     * smaller than the minimum movement or than that drift, are never recommended.
+     */
+    void setTolerances(const DataParser &parser);
+
+    /**
+     * @brief Number of amplitudes, evenly spaced up to the largest one, tried for each joint.
+     */
+    inline void setNAmplitudes(unsigned int val)
+    {
+        n_amplitudes = std::max(val, 1u);
+    }
+
+    /**
+     * @brief Current uncertainty of the axes.
+     * 
+     * Trace of the covariance of the axes estimated by \ref Identification::refineAxes, i.e.,
+     * the expected sum of the squared axis errors, in squared radians. The measurement noise
+     * variance is estimated from the residuals, or taken as one while there are too few experiments.
+     * 
+     * @param axes current estimate of the axes, preferably refined
+     * @param start_from_last chain the joints starting from the last one
+     */
+    double computeUncertainty(const Eigen::Matrix<double, 3, Eigen::Dynamic> &axes, bool start_from_last = false);
+
+    /**
+     * @brief Recommends the single-joint move that most reduces the uncertainty of the axes.
+     * 
+     * Every joint is tried with the amplitudes allowed by the movement tolerances and the joint limits,
+     * moving towards the limit that is furthest away.
+     * 
+     * @param theta current joint angles
+     * @param axes current estimate of the axes, preferably refined
+     * @param start_from_last chain the joints starting from the last one
+     * @see computeUncertainty
+     */
+    Move planNextMove(const Eigen::VectorXd &theta, const Eigen::Matrix<double, 3, Eigen::Dynamic> &axes,
+        bool start_from_last = false);
+};
+
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <Eigen/Dense>
+
+namespace axes_ident
+{
+
+/**
+ * @brief Compact, append-only store of the experiments of a recording.
+ *
+ * Experiments are kept in recording order as a byte stream. In a valid experiment only one joint
+ * moves beyond the stall tolerance, so a record holds the index of the moving joint, its new angle,
+ * the orientation and, for the remaining joints, only the values that differ from the ones decoded
+ * so far. These stall-level changes are kept exactly or quantized to a configured bound. Every
+ * keyframe interval, a record holds every joint angle, so decoding may start from it.
+ *
+ * Records are read back in order with a \ref Decoder, without expanding them into a dense matrix.
+ */
+class ExperimentStore
+{
+public:
+    /**
+     * @brief Default number of records between keyframes.
+     */
+    const static unsigned int DEFAULT_KEYFRAME_INTERVAL = 64;
+
+    /**
+     * @brief Single experiment, equivalent to a pair of rows of \ref DataParser::getDataByJoint.
+     */
+    struct Record
+    {
+        unsigned int joint;
+        unsigned int ind_experiment;
+        double delta_angle;
+        Eigen::VectorXd theta;
+        Eigen::Vector3d rpy_last, rpy_curr;
+    };
+
+    /**
+     * @brief Reads the records of a store in order.
+     *
+     * Buffers are kept when the decoder is reset, so a decoder reused for stores with the
+     * same number of joints does not allocate memory.
+     */
+    class Decoder
+    {
+    private:
+        const ExperimentStore *store;
+        std::size_t offset, offset_end;
+        std::vector<unsigned int> n_experiments;
+        Record record;
+
+    public:
+        Decoder();
+
+        /**
+         * @brief Starts decoding a store.
+         *
+         * @param store store to decode, which must outlive the decoding.
+         * @param ind_keyframe keyframe from which decoding starts.
+         * @param ind_keyframe_end keyframe at which decoding stops, by default the end of the store.
+         */
+        void reset(const ExperimentStore &store, unsigned int ind_keyframe = 0,
+            unsigned int ind_keyframe_end = std::numeric_limits<unsigned int>::max());
+
+        /**
+         * @brief Decodes the next record.
+         *
+         * @return true if a record was decoded, see \ref getRecord.
+         * @return false if every record was already decoded.
+         */
+        bool next();
+
+        inline const Record & getRecord() const
+        {
+            return record;
+        }
+    };
+
+private:
+    /**
+     * @brief Flags in the first byte of each record.
+     */
+    enum Flags
+    {
+        KEYFRAME         = (1u << 0),
+        LAST_ORIENTATION = (1u << 1),
+        DELTA_ANGLE      = (1u << 2)
+    };
+
+    unsigned int n_joints;
+    double tol_quantization;
+    unsigned int keyframe_interval;
+    std::vector<unsigned char> buffer;
+    std::vector<std::size_t> keyframes;
+    // Experiments of each joint before each keyframe, so decoding may start from it
+    std::vector<unsigned int> keyframe_experiments;
+    std::vector<unsigned int> n_experiments;
+    unsigned int n_records;
+    // Last values as seen by a decoder, so quantization errors do not accumulate
+    Eigen::VectorXd theta_reference;
+    Eigen::Vector3d rpy_reference;
+
+    template <typename T>
+    inline void _write(const T &value)
+    {
+        const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&value);
+        buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+    }
+
+    inline std::size_t _bitmaskSize() const
+    {
+        return (n_joints + 7) / 8;
+    }
+
+public:
+    ExperimentStore();
+
+    /**
+     * @brief Removes every record and configures the encoding.
+     *
+     * @param n_joints number of joints of each experiment.
+     * @param tol_quantization largest error allowed on the joints that did not move, zero to keep them exactly.
+     * @param keyframe_interval number of records between keyframes.
+     */
+    void reset(unsigned int n_joints, double tol_quantization = 0,
+        unsigned int keyframe_interval = DEFAULT_KEYFRAME_INTERVAL);
+
+    /**
+     * @brief Removes every record, keeping the configuration.
+     */
+    inline void clear()
+    {
+        this->reset(n_joints, tol_quantization, keyframe_interval);
+    }
+
+    /**
+     * @brief Appends an experiment.
+     *
+     * @param joint joint that moved.
+     * @param row_last data row before the move, [theta, rpy_angle].
+     * @param row_curr data row after the move, [theta, rpy_angle].
+     */
+    void append(unsigned int joint, const Eigen::Ref<const Eigen::RowVectorXd> &row_last,
+        const Eigen::Ref<const Eigen::RowVectorXd> &row_curr);
+
+    inline unsigned int getNJoints() const
+    {
+        return n_joints;
+    }
+
+    /**
+     * @brief Number of records, i.e., experiments of every joint.
+     */
+    inline unsigned int getNRecords() const
+    {
+        return n_records;
+    }
+
+    /**
+     * @brief Number of experiments in which the given joint moved.
+     */
+    inline unsigned int getNExperiments(unsigned int joint) const
+    {
+        return (joint < n_experiments.size()) ? n_experiments[joint] : 0;
+    }
+
+    inline unsigned int getNKeyframes() const
+    {
+        return keyframes.size();
+    }
+
+    inline double getToleranceQuantization() const
+    {
+        return tol_quantization;
+    }
+
+    /**
+     * @brief Bytes used by the records and the keyframe index.
+     */
+    inline std::size_t getMemoryUsage() const
+    {
+        return buffer.size() + keyframes.size() * sizeof(std::size_t)
+            + keyframe_experiments.size() * sizeof(unsigned int);
+    }
+};
+
+}
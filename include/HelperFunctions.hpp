@@ -67,6 +67,18 @@ public:
         return ret;
     }
 
+    /**
+     * @brief Derivative of rotAngleAxis(ang, h) with respect to h along the direction b.
+     */
+    template <class type>
+    inline static Eigen::Matrix<type, 3, 3> dRotAngleAxis(double ang, const Eigen::Matrix<type, 3, 1> &h,
+        const Eigen::Matrix<type, 3, 1> &b)
+    {
+        double c = cos(ang);
+        double s = sin(ang);
+        return s * skew<type>(b) + (1 - c) * (b * h.transpose() + h * b.transpose());
+    }
+
     template <class type>
     inline static Eigen::Matrix<type, 3, 1> axisFromRot(const Eigen::Matrix<type, 3, 3> &rot, type delta_theta)
     {
@@ -75,6 +87,30 @@ public:
         axis = axis / 2 / sin(delta_theta);
         return axis;
     }
+
+    template <class type>
+    inline static Eigen::Matrix<type, 3, 3> skew(const Eigen::Matrix<type, 3, 1> &v)
+    {
+        Eigen::Matrix<type, 3, 3> ret;
+        ret <<     0, -v(2),  v(1),
+                v(2),     0, -v(0),
+               -v(1),  v(0),     0;
+        return ret;
+    }
+
+    /**
+     * @brief Orthonormal basis of the plane orthogonal to the unit vector h.
+     */
+    template <class type>
+    inline static Eigen::Matrix<type, 3, 2> tangentBasis(const Eigen::Matrix<type, 3, 1> &h)
+    {
+        Eigen::Matrix<type, 3, 1> other = (std::abs(h(0)) < 0.9) ?
+            Eigen::Matrix<type, 3, 1>::UnitX() : Eigen::Matrix<type, 3, 1>::UnitY();
+        Eigen::Matrix<type, 3, 2> ret;
+        ret.col(0) = h.cross(other).normalized();
+        ret.col(1) = h.cross(ret.col(0));
+        return ret;
+    }
 };
 
 }
\ No newline at end of file
@@ -9,21 +9,208 @@ namespace axes_ident
 
 class Identification
 {
+public:
+    /**
+     * @brief Default maximum number of iterations of the global refinement.
+     */
+    const static unsigned int DEFAULT_REFINEMENT_MAX_ITERATIONS = 50;
+
+    /**
+     * @brief Default step size below which the global refinement is considered converged.
+     */
+    constexpr static double DEFAULT_REFINEMENT_TOLERANCE = 1e-10;
+
+    /**
+     * @brief How \ref identifyAxes combines the axis measured by each experiment of a joint.
+     */
+    enum Estimator
+    {
+        /** Plain mean of the measurements. */
+        MEAN,
+        /** Mean weighted by the squared sine of the move, which scales the noise of each measurement. */
+        WEIGHTED_MEAN,
+        /** Weighted mean with Huber weights, started from the median, rejecting outliers. */
+        HUBER
+    };
+
+    /**
+     * @brief Default residual, in multiples of the median residual, above which \ref Estimator.HUBER down-weights experiments.
+     */
+    constexpr static double DEFAULT_HUBER_THRESHOLD = 2;
+
+    /**
+     * @brief Default residual, in multiples of the median residual, above which \ref Estimator.HUBER rejects experiments.
+     */
+    constexpr static double DEFAULT_REJECTION_THRESHOLD = 4;
+
+    /**
+     * @brief Default maximum number of reweighting iterations of \ref Estimator.HUBER.
+     */
+    const static unsigned int DEFAULT_ROBUST_MAX_ITERATIONS = 20;
+
+    /**
+     * @brief Default change of the axis below which the reweighting of \ref Estimator.HUBER is considered converged.
+     */
+    constexpr static double DEFAULT_ROBUST_TOLERANCE = 1e-10;
+
+private:
+    /**
+     * @brief Single experiment as seen by the global refinement.
+     *
+     * Q * R * Q^T should equal the rotation of delta_angle about the axis of the moving
+     * joint, where Q is the rotation chain of the joints identified before it.
+     */
+    struct Experiment
+    {
+        unsigned int ind_order;
+        double delta_angle;
+        Eigen::VectorXd theta;
+        Eigen::Matrix3d R;
+    };
+
+public:
+    /**
+     * @brief Scratch memory of \ref identifyAxes.
+     *
+     * Buffers are kept between calls, so identifications reusing a workspace do not allocate
+     * memory once it has been warmed up. Concurrent calls must each use their own workspace.
+     */
+    class Workspace
+    {
+    public:
+        /**
+         * @brief Number of experiments of each joint rejected as outliers by the last identification.
+         */
+        inline const std::vector<unsigned int> & getNRejected() const
+        {
+            return n_rejected;
+        }
+
+    private:
+        friend class Identification;
+
+        /**
+         * @brief Scratch memory of a thread assembling the normal equations.
+         */
+        struct ThreadScratch
+        {
+            Eigen::MatrixXd JtJ;
+            Eigen::VectorXd Jtr;
+            Eigen::Matrix<double, 9, Eigen::Dynamic> J;
+            std::vector<Eigen::Matrix3d> G, Q_partial;
+            double cost;
+            // Experiment decoded from the compact store
+            Experiment experiment;
+            ExperimentStore::Decoder decoder;
+        };
+
+        Eigen::Matrix<double, 3, Eigen::Dynamic> axes, axes_candidate;
+        std::vector<Eigen::Matrix<double, 3, Eigen::Dynamic>> axes_measurements;
+        std::vector<Eigen::VectorXd> axes_weights;
+        std::vector<unsigned int> n_rejected;
+        std::vector<double> residuals, robust_weights, sorted;
+        std::vector<unsigned int> ind_joint_order, ind_order;
+        // Only filled for dense data, experiments of the compact store are decoded as they are used
+        std::vector<Experiment> experiments;
+        unsigned int n_experiments;
+        bool skip_rejected;
+        std::vector<Eigen::Matrix<double, 3, 2>> basis;
+        std::vector<ThreadScratch> threads;
+        Eigen::MatrixXd JtJ, A;
+        Eigen::VectorXd Jtr, delta;
+        Eigen::LDLT<Eigen::MatrixXd> ldlt;
+        ExperimentStore::Decoder decoder;
+    };
+
 private:
     std::vector<DataParser::Data> data;
+    ExperimentStore store;
     Eigen::Matrix<double, 3, Eigen::Dynamic> axes;
 
     unsigned int n_joints;
+    Estimator estimator;
+    double tol_huber, tol_rejection;
+    unsigned int robust_max_iterations;
+    double tol_robust;
 
     void _resizeAxes(unsigned int n_joints);
     bool _checkNJoints();
 
+    void _jointOrder(std::vector<unsigned int> &ind_joint_order, bool start_from_last) const;
+
+    /**
+     * @brief Calls callback(ind_exp, theta, delta_angle, rpy_last, rpy_curr) for each experiment of a joint.
+     * 
+     * Experiments are read from the dense data or streamed from the compact store, whichever was set.
+     */
+    template <typename Callback>
+    void _forEachExperiment(Workspace &workspace, unsigned int joint, Callback callback) const;
+
+    /**
+     * @brief Combines the measurements of a joint, stored in the workspace, with the selected estimator.
+     *
+     * On input, the workspace holds the base weight of each measurement; on output, rejected
+     * measurements have zero weight and are counted.
+     *
+     * @return unit axis
+     */
+    Eigen::Vector3d _estimateAxis(Workspace &workspace, unsigned int joint) const;
+
+    /**
+     * @brief Sets an experiment from the orientations measured before and after the move.
+     */
+    void _setExperiment(Experiment &experiment, unsigned int ind_order, double delta_angle,
+        const Eigen::Ref<const Eigen::VectorXd> &theta, const Eigen::Ref<const Eigen::Vector3d> &rpy_last,
+        const Eigen::Ref<const Eigen::Vector3d> &rpy_curr, bool start_from_last) const;
+
+    /**
+     * @brief Prepares the experiments and the order in which joints are chained in the workspace.
+     *
+     * Dense data is collected into the workspace, while the compact store is left to be
+     * decoded by \ref _accumulateNormalEquations.
+     *
+     * @param skip_rejected leave out the experiments rejected by the last identification in the workspace
+     */
+    void _prepareExperiments(Workspace &workspace, bool start_from_last, bool skip_rejected = false) const;
+
+    /**
+     * @brief Residual of a single experiment and, optionally, its Jacobian into scratch.J.
+     *
+     * Columns of the Jacobian follow ind_joint_order and only the leading 2 * (ind_order + 1) are set.
+     */
+    Eigen::Matrix3d _experimentResidual(const Experiment &experiment,
+        const Eigen::Matrix<double, 3, Eigen::Dynamic> &axes, bool start_from_last,
+        const std::vector<unsigned int> &ind_joint_order, const std::vector<Eigen::Matrix<double, 3, 2>> &basis,
+        Workspace::ThreadScratch &scratch, bool with_jacobian) const;
+
+    /**
+     * @brief Evaluates the refinement cost and, optionally, the normal equations into the workspace.
+     *
+     * Unknowns are ordered as in ind_joint_order, two tangent-plane coordinates per axis,
+     * so an experiment on the c-th identified joint only touches the leading 2 * (c + 1)
+     * unknowns and the normal matrix is assembled block by block. The compact store is decoded
+     * once per call, each thread starting from its own keyframes.
+     *
+     * @return sum of the squared residuals
+     */
+    double _accumulateNormalEquations(Workspace &workspace, const Eigen::Matrix<double, 3, Eigen::Dynamic> &axes,
+        bool start_from_last, bool with_jacobian) const;
+
+    /**
+     * @brief Refines the axes stored in the workspace in place.
+     */
+    void _refineAxes(Workspace &workspace, bool start_from_last, unsigned int max_iterations, double tol,
+        bool skip_rejected = false) const;
+
 public:
     Identification(unsigned int n_joints);
 
     /**
      * @brief Set the Data object
      * 
+     * Experiments are taken from \ref DataParser::getDataByJoint or, if the parser only
+     * has the \ref DataParser::Storage.COMPACT storage, from \ref DataParser::getExperimentStore.
+     * 
      * @param parser with M x (robot.getNJoints() + 4) data matrix containing experimental
      * data, where each row is a single measurement [theta, rpy_angle, n_joint]:
      *      theta: 1 x N vector with encoder measurements
@@ -37,6 +224,131 @@ public:
      */
     bool setData(const DataParser &parser);
 
-    Eigen::Matrix<double, 3, Eigen::Dynamic> identifyAxes(bool start_from_last = false);
+    /**
+     * @brief Appends the experiments the parser gained since the last call to \ref setData or \ref updateData.
+     * 
+     * Meant to be used with \ref DataParser::followFile. Only the new rows are copied. If the
+     * stored experiments are not a prefix of the parser's anymore, e.g., because the followed
+     * file was replaced, everything is copied again. Compact stores are always copied entirely.
+     * 
+     * @return true data successfully stored
+     * @return false data did not meet the required standards
+     */
+    bool updateData(const DataParser &parser);
+
+    /**
+     * @brief Chooses how the experiments of each joint are combined into its axis, see \ref Estimator.
+     * 
+     * Residuals are measured in multiples of the median residual, so thresholds must be at least one:
+     * lower values would down-weight or reject most experiments.
+     * 
+     * @param estimator the estimator, \ref Estimator.MEAN by default
+     * @param tol_huber residual above which \ref Estimator.HUBER down-weights experiments
+     * @param tol_rejection residual above which \ref Estimator.HUBER rejects experiments, at least tol_huber
+     * @param max_iterations maximum number of reweighting iterations of \ref Estimator.HUBER, at least one
+     * @param tol change of the axis below which the reweighting stops
+     */
+    void setEstimator(Estimator estimator, double tol_huber = DEFAULT_HUBER_THRESHOLD,
+        double tol_rejection = DEFAULT_REJECTION_THRESHOLD, unsigned int max_iterations = DEFAULT_ROBUST_MAX_ITERATIONS,
+        double tol = DEFAULT_ROBUST_TOLERANCE);
+
+    /**
+     * @brief Identifies the joint axes one at a time following the joint order.
+     * 
+     * The experiments of each joint are combined with the estimator chosen by \ref setEstimator.
+     * Experiments rejected as outliers are counted in \ref Workspace::getNRejected and left out
+     * of the refinement.
+     * 
+     * Does not modify the object, so it may be called concurrently as long as each
+     * caller passes its own workspace.
+     * 
+     * @param workspace scratch memory reused between calls
+     * @param start_from_last chain the joints starting from the last one
+     * @param refine jointly refine every axis after the greedy identification
+     * @return reference to the axes stored in the workspace, valid until its next use
+     * @see refineAxes
+     */
+    const Eigen::Matrix<double, 3, Eigen::Dynamic> & identifyAxes(Workspace &workspace,
+        bool start_from_last = false, bool refine = false) const;
+
+    /**
+     * @brief Identifies the joint axes using a temporary workspace.
+     * 
+     * @see identifyAxes(Workspace &, bool, bool) const
+     */
+    Eigen::Matrix<double, 3, Eigen::Dynamic> identifyAxes(bool start_from_last = false, bool refine = false) const;
+
+    /**
+     * @brief Jointly refines all axes so that they fit every experiment at once.
+     * 
+     * Solves the least-squares problem whose per-joint solutions are the greedy
+     * estimates of \ref identifyAxes, but without freezing the axes identified
+     * earlier, so errors in the first axes are no longer propagated to the last ones.
+     * The cost of each iteration is linear in the number of experiments.
+     * 
+     * @param axes_initial initial guess, usually the result of \ref identifyAxes
+     * @param start_from_last must match the value used to compute the initial guess
+     * @param max_iterations maximum number of Levenberg-Marquardt iterations
+     * @param tol step size below which the refinement stops
+     */
+    Eigen::Matrix<double, 3, Eigen::Dynamic> refineAxes(const Eigen::Matrix<double, 3, Eigen::Dynamic> &axes_initial,
+        bool start_from_last = false,
+        unsigned int max_iterations = DEFAULT_REFINEMENT_MAX_ITERATIONS,
+        double tol = DEFAULT_REFINEMENT_TOLERANCE) const;
+
+    inline unsigned int getNJoints() const
+    {
+        return n_joints;
+    }
+
+    /**
+     * @brief Number of valid experiments in which the given joint moved.
+     */
+    inline unsigned int getNExperiments(unsigned int joint) const
+    {
+        if (data.empty())
+            return store.getNExperiments(joint);
+        return (joint < data.size()) ? data[joint].rows() / 2 : 0;
+    }
+
+    /**
+     * @brief Gauss-Newton approximation of the information that the experiments carry about the axes.
+     * 
+     * Each axis is described by two coordinates on the plane tangent to it, spanned by
+     * \ref HelperFunctions::tangentBasis, and unknowns are ordered by joint index.
+     * Up to the measurement noise variance, the inverse of the information is the
+     * covariance of the axes estimated by \ref refineAxes.
+     * 
+     * @param workspace scratch memory reused between calls
+     * @param axes axes at which the information is evaluated
+     * @param information 2N x 2N information matrix
+     * @param start_from_last chain the joints starting from the last one
+     * @return sum of the squared residuals of the experiments
+     */
+    double computeInformation(Workspace &workspace, const Eigen::Matrix<double, 3, Eigen::Dynamic> &axes,
+        Eigen::MatrixXd &information, bool start_from_last = false) const;
+
+    /**
+     * @brief Jacobian of a noise-free experiment that has not been performed yet.
+     * 
+     * @param workspace scratch memory reused between calls
+     * @param axes axes at which the Jacobian is evaluated
+     * @param theta joint angles after the move
+     * @param joint joint that moves
+     * @param delta_angle how much the joint moves to arrive at theta
+     * @param J 9 x 2N Jacobian, with unknowns ordered as in \ref computeInformation
+     * @param start_from_last chain the joints starting from the last one
+     */
+    void computeExperimentJacobian(Workspace &workspace, const Eigen::Matrix<double, 3, Eigen::Dynamic> &axes,
+        const Eigen::VectorXd &theta, unsigned int joint, double delta_angle,
+        Eigen::Matrix<double, 9, Eigen::Dynamic> &J, bool start_from_last = false) const;
+
+    /**
+     * @brief Root mean square over every experiment of the chordal distance between the measured
+     * and the predicted rotations.
+     * 
+     * This is the quantity minimized by \ref refineAxes.
+     */
+    double computeResidual(const Eigen::Matrix<double, 3, Eigen::Dynamic> &axes, bool start_from_last = false) const;
 };
 }
\ No newline at end of file
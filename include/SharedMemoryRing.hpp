@@ -0,0 +1,179 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace axes_ident
+{
+
+/**
+ * @brief Ring of samples in POSIX shared memory, written by an acquisition process and read by \ref DataParser.
+ * 
+ * The memory starts with a header followed by capacity slots. Each slot holds the sequence
+ * number of its sample and the n_joints + 3 values of a data file row, i.e., the joint angles
+ * followed by roll, pitch and yaw, as native doubles. Sample s lives in slot s % capacity and
+ * write_sequence counts the samples published so far, so a reader that falls more than capacity
+ * samples behind, or whose slot is overwritten while being read, detects the overrun from the
+ * sequence numbers.
+ * 
+ * The layout is fixed once the ring is mapped: a producer that restarts creates a new shared
+ * memory object under the same name, which consumers detect and open again.
+ */
+class SharedMemoryRing
+{
+public:
+    /**
+     * @brief Identifies the layout described in this file.
+     */
+    const static std::uint32_t MAGIC = 0x53455841;
+
+    /**
+     * @brief Version of the layout described in this file.
+     */
+    const static std::uint32_t VERSION = 1;
+
+    /**
+     * @brief Sequence number of a slot that is being written.
+     */
+    const static std::uint64_t SEQUENCE_BUSY = ~std::uint64_t(0);
+
+    /**
+     * @brief Layout of the beginning of the shared memory.
+     */
+    struct Header
+    {
+        std::uint32_t magic;
+        std::uint32_t version;
+        std::uint32_t n_joints;
+        std::uint32_t capacity;
+        std::atomic<std::uint64_t> write_sequence;
+    };
+
+private:
+    std::string name;
+    int fd;
+    void *memory;
+    std::size_t size;
+    bool owner;
+    Header *header;
+    unsigned char *slots;
+    std::size_t slot_size;
+    // Layout as mapped, the header in shared memory is not trusted afterwards
+    unsigned int n_joints, capacity, n_values;
+
+    /**
+     * @brief Offset of the first slot, aligned to a cache line.
+     */
+    constexpr static std::size_t _headerSize()
+    {
+        return (sizeof(Header) + 63) / 64 * 64;
+    }
+
+    inline std::atomic<std::uint64_t> & _slotSequence(std::uint64_t sequence) const
+    {
+        return *reinterpret_cast<std::atomic<std::uint64_t> *>(slots + (sequence % capacity) * slot_size);
+    }
+
+    inline unsigned char * _slotValues(std::uint64_t sequence) const
+    {
+        return slots + (sequence % capacity) * slot_size + sizeof(std::uint64_t);
+    }
+
+    bool _map(int prot);
+
+public:
+    SharedMemoryRing();
+    ~SharedMemoryRing();
+
+    SharedMemoryRing(const SharedMemoryRing &) = delete;
+    SharedMemoryRing & operator=(const SharedMemoryRing &) = delete;
+
+    /**
+     * @brief Creates the ring, as the producer. It is removed when this object is closed or destroyed.
+     * 
+     * A ring left under the same name, e.g., by a producer that crashed, is unlinked first, so
+     * consumers that still map it are not affected and open the new one instead.
+     * 
+     * @param name POSIX shared memory object name, e.g., "/robot_samples".
+     * @param n_joints number of joints of each sample.
+     * @param capacity number of samples kept in the ring.
+     * @return true if the ring was created.
+     * @return false if it fails.
+     */
+    bool create(const std::string &name, unsigned int n_joints, unsigned int capacity);
+
+    /**
+     * @brief Maps an existing ring read-only, as a consumer.
+     * 
+     * @param name POSIX shared memory object name.
+     * @return true if the ring was mapped and has a valid layout.
+     * @return false if it fails.
+     */
+    bool open(const std::string &name);
+
+    /**
+     * @brief Unmaps the ring, removing it if it was created by this object.
+     * 
+     * A removed ring is marked invalid first, so consumers that still map it notice.
+     */
+    void close();
+
+    /**
+     * @brief Checks whether the mapped header still describes the layout it was mapped with.
+     */
+    bool hasValidHeader() const;
+
+    /**
+     * @brief Checks whether the name no longer refers to the mapped ring, i.e., it was removed or recreated.
+     */
+    bool isReplaced() const;
+
+    /**
+     * @brief Writes the next sample, overwriting the oldest one if the ring is full.
+     * 
+     * @param values getNJoints() + 3 values, joint angles followed by roll, pitch and yaw.
+     */
+    void publish(const double *values);
+
+    /**
+     * @brief Reads a sample directly from the ring.
+     * 
+     * @param sequence sequence number of the sample.
+     * @param values where the getNJoints() + 3 values are written.
+     * @return true if the sample was read.
+     * @return false if it was overwritten before or while being read.
+     */
+    bool read(std::uint64_t sequence, double *values) const;
+
+    inline bool isOpen() const
+    {
+        return header != nullptr;
+    }
+
+    inline const std::string & getName() const
+    {
+        return name;
+    }
+
+    /**
+     * @brief Number of samples published so far, which is also the sequence number of the next one.
+     */
+    inline std::uint64_t getWriteSequence() const
+    {
+        return header->write_sequence.load(std::memory_order_acquire);
+    }
+
+    inline unsigned int getNJoints() const
+    {
+        return n_joints;
+    }
+
+    inline unsigned int getCapacity() const
+    {
+        return capacity;
+    }
+};
+
+}
@@ -3,14 +3,28 @@
 #include <iostream>
 #include <iterator>
 #include <vector>
+#include <algorithm>
+#include <cmath>
 
 using namespace axes_ident;
 
+namespace
+{
+// Rows are added geometrically, so appending to a matrix only allocates memory now and then
+void reserveRows(DataParser::Data &matrix, Eigen::Index n_rows)
+{
+    if (matrix.rows() < n_rows)
+        matrix.conservativeResize(std::max(n_rows, 2 * matrix.rows()), Eigen::NoChange);
+}
+}
+
 DataParser::DataParser() :
-    delim(' '), header_size(0), n_joints(0),
+    delim(' '), header_size(0), n_joints(0), n_rows_data(0),
+    tol_quantization(0), keyframe_interval(ExperimentStore::DEFAULT_KEYFRAME_INTERVAL),
     ok_data(false), tol_max_stall_movement(DataParser::DEFAULT_MAX_STALL_MOVEMENT),
     tol_min_movement(DataParser::DEFAULT_MIN_MOVEMENT),
-    mask_storage(Storage::SINGLE | Storage::MULTIPLE)
+    mask_storage(Storage::SINGLE | Storage::MULTIPLE), follow(),
+    ring_sequence(0), n_lost_samples(0)
 {
 }
 
@@ -64,18 +78,42 @@ void DataParser::_arrangeStorage()
     {
         DataParser::splitExperimentIntoJoints(data_by_joint, data, n_joints);
     }
+    if (this->_hasStorageMask(Storage::COMPACT))
+    {
+        // Same pairing as splitExperimentIntoJoints
+        store.reset(n_joints, tol_quantization, keyframe_interval);
+        unsigned int ind_last = data.cols() - 1;
+        unsigned int ind_row_last = 0;
+        for (unsigned int k = 1; k < data.rows(); ++k)
+        {
+            int ind_joint = data(k, ind_last);
+            if (ind_joint == DataParser::INDEX_INVALID)
+                continue;
+            store.append(ind_joint, data.row(ind_row_last).head(n_joints + 3), data.row(k).head(n_joints + 3));
+            ind_row_last = k;
+        }
+    }
 
     // Free memory if the user does not require this storage type
     if (!this->_hasStorageMask(Storage::SINGLE))
     {
         data.resize(0,0);
     }
+    this->_setRowsInUse();
+}
+
+void DataParser::_setRowsInUse()
+{
+    n_rows_data = data.rows();
+    n_rows_by_joint.resize(data_by_joint.size());
+    for (unsigned int k = 0; k < data_by_joint.size(); ++k)
+        n_rows_by_joint[k] = data_by_joint[k].rows();
 }
 
 bool DataParser::_configureDataMatrices()
 {
     n_joints = data.cols() - 3;
-    DataParser::appendMovingJointIndex(data, n_joints, tol_max_stall_movement);
+    DataParser::appendMovingJointIndex(data, n_joints, tol_max_stall_movement, tol_min_movement);
     ok_data = this->_validateMovingJointIndices();
     if (!ok_data)
     {
@@ -113,6 +151,31 @@ void DataParser::splitExperimentIntoJoints(std::vector<Data> &data_by_joint, con
     }
 }
 
+int DataParser::_movingJointIndex(const Eigen::Ref<const Eigen::RowVectorXd> &last_row,
+    const Eigen::Ref<const Eigen::RowVectorXd> &row, double tol_max_stall_movement, double tol_min_movement)
+{
+    // Largest and second largest movements, in a single pass
+    int index_max = 0;
+    double movement_max = 0, movement_stall_max = 0;
+    for (Eigen::Index k = 0; k < row.size(); ++k)
+    {
+        double movement = std::abs(row(k) - last_row(k));
+        if (movement > movement_max)
+        {
+            movement_stall_max = movement_max;
+            movement_max = movement;
+            index_max = k;
+        }
+        else if (movement > movement_stall_max)
+        {
+            movement_stall_max = movement;
+        }
+    }
+    if (movement_max < tol_min_movement)
+        return DataParser::INDEX_INVALID;
+    return (movement_stall_max > tol_max_stall_movement) ? DataParser::INDEX_INVALID : index_max;
+}
+
 void DataParser::appendMovingJointIndex(DataParser::Data &data, unsigned int n_joints, double tol_max_stall_movement, double tol_min_movement)
 {
     data.conservativeResize(data.rows(), data.cols() + 1);
@@ -120,23 +183,197 @@ void DataParser::appendMovingJointIndex(DataParser::Data &data, unsigned int n_j
 
     unsigned int ind_last = data.cols() - 1;
     data(0, ind_last) = DataParser::INDEX_INVALID;
-    Eigen::ArrayXd last_row = joints.row(0).array(), row, row_diff;
-    Eigen::ArrayXd::Index index_max, index_stall_max;
     for (unsigned int k = 1; k < data.rows(); ++k)
     {
-        row = joints.row(k).array();
-        row_diff = Eigen::abs(row - last_row);
-        row_diff.maxCoeff(&index_max);
-        if (row_diff(index_max) < tol_min_movement)
-            data(k, ind_last) = DataParser::INDEX_INVALID;
+        data(k, ind_last) = DataParser::_movingJointIndex(joints.row(k - 1), joints.row(k),
+            tol_max_stall_movement, tol_min_movement);
+    }
+}
+
+void DataParser::_appendRows(const Eigen::Ref<const Data> &rows)
+{
+    if (rows.rows() == 0)
+        return;
+
+    unsigned int k_first = 0;
+    if (n_joints == 0)
+    {
+        if (rows.cols() < 4)
+        {
+            std::cerr << "[Error] Rows should hold at least one joint angle and the orientation." << std::endl;
+            return;
+        }
+        n_joints = rows.cols() - 3;
+        follow.max_index = DataParser::INDEX_INVALID;
+        follow.last_row = rows.row(0);
+        follow.last_valid_row.resize(rows.cols() + 1);
+        follow.last_valid_row << rows.row(0), DataParser::INDEX_INVALID;
+        data.resize(0, this->_hasStorageMask(Storage::SINGLE) ? rows.cols() + 1 : 0);
+        data_by_joint.clear();
+        if (this->_hasStorageMask(Storage::MULTIPLE))
+            data_by_joint.resize(n_joints, Data(0, rows.cols() + 1));
+        this->_setRowsInUse();
+        store.reset(n_joints, tol_quantization, keyframe_interval);
+        if (this->_hasStorageMask(Storage::SINGLE))
+        {
+            reserveRows(data, 1);
+            data.row(n_rows_data++) << rows.row(0), DataParser::INDEX_INVALID;
+        }
+        k_first = 1;
+    }
+
+    // Same classification as appendMovingJointIndex, using the last row parsed in the previous call
+    std::vector<int> &indices = scratch_indices;
+    std::vector<unsigned int> &n_new_experiments = scratch_n_experiments;
+    indices.resize(rows.rows());
+    n_new_experiments.assign(n_joints, 0);
+    for (unsigned int k = k_first; k < rows.rows(); ++k)
+    {
+        if (k == 0)
+            indices[k] = DataParser::_movingJointIndex(follow.last_row.head(n_joints), rows.row(k).head(n_joints),
+                tol_max_stall_movement, tol_min_movement);
         else
+            indices[k] = DataParser::_movingJointIndex(rows.row(k - 1).head(n_joints), rows.row(k).head(n_joints),
+                tol_max_stall_movement, tol_min_movement);
+        if (indices[k] != DataParser::INDEX_INVALID)
         {
-            row_diff(index_max) = 0;
-            row_diff.maxCoeff(&index_stall_max);
-            data(k, ind_last) = (row_diff(index_stall_max) > tol_max_stall_movement) ? DataParser::INDEX_INVALID : index_max;
+            ++n_new_experiments[indices[k]];
+            follow.max_index = std::max(follow.max_index, indices[k]);
         }
-        last_row = row;
     }
+    follow.last_row = rows.row(rows.rows() - 1);
+
+    if (this->_hasStorageMask(Storage::SINGLE))
+    {
+        reserveRows(data, n_rows_data + rows.rows() - k_first);
+        for (unsigned int k = k_first; k < rows.rows(); ++k)
+            data.row(n_rows_data++) << rows.row(k), indices[k];
+    }
+
+    // Same pairing as splitExperimentIntoJoints, using the last valid row parsed in the previous call
+    bool multiple = this->_hasStorageMask(Storage::MULTIPLE);
+    bool compact = this->_hasStorageMask(Storage::COMPACT);
+    for (unsigned int j = 0; multiple && j < n_joints; ++j)
+        reserveRows(data_by_joint[j], n_rows_by_joint[j] + 2 * n_new_experiments[j]);
+    for (unsigned int k = k_first; k < rows.rows(); ++k)
+    {
+        if (indices[k] == DataParser::INDEX_INVALID)
+            continue;
+        if (multiple)
+        {
+            Data &experiments = data_by_joint[indices[k]];
+            unsigned int &index_row = n_rows_by_joint[indices[k]];
+            experiments.row(index_row++) = follow.last_valid_row;
+            experiments.row(index_row++) << rows.row(k), indices[k];
+        }
+        if (compact)
+            store.append(indices[k], follow.last_valid_row.head(n_joints + 3), rows.row(k));
+        follow.last_valid_row << rows.row(k), indices[k];
+    }
+
+    ok_data = (follow.max_index == (int) n_joints - 1);
+}
+
+bool DataParser::_isSameFollowedFile(std::ifstream &file, std::streamoff file_size)
+{
+    if (file_size < follow.offset)
+        return false;
+    if (follow.first_line.empty())
+        return true;
+    std::string first_line(follow.first_line.size(), '\0');
+    file.seekg(follow.offset_data);
+    file.read(&first_line[0], first_line.size());
+    return file.good() && first_line == follow.first_line;
+}
+
+bool DataParser::followFile(const std::string &fname)
+{
+    std::ifstream file(fname, std::ios_base::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "[Error] Failed to open " << fname << ". Check the file path!" << std::endl;
+        return false;
+    }
+    file.seekg(0, std::ios_base::end);
+    std::streamoff file_size = file.tellg();
+
+    if (fname != follow.fname || !this->_isSameFollowedFile(file, file_size))
+    {
+        if (!follow.fname.empty() && fname == follow.fname)
+            std::clog << "[Warn] " << fname << " was truncated or replaced. Reading it from the start." << std::endl;
+        this->clear();
+        file.clear();
+        _jumpHeader(file);
+        if (!file.good())
+        {
+            // The header has not been completely written yet
+            return false;
+        }
+        follow.fname = fname;
+        follow.offset_data = file.tellg();
+        follow.offset = follow.offset_data;
+    }
+
+    // Like readFile, nothing after an empty line is parsed
+    if (follow.stopped)
+        return ok_data;
+
+    std::string chunk(file_size - follow.offset, '\0');
+    file.clear();
+    file.seekg(follow.offset);
+    file.read(&chunk[0], chunk.size());
+    file.close();
+
+    // Only complete lines are parsed, the remainder is read again in the next call
+    std::size_t end = chunk.rfind('\n');
+    if (end == std::string::npos)
+        return ok_data;
+    follow.offset += end + 1;
+
+    std::vector<std::vector<double>> values;
+    std::size_t begin = 0;
+    while (begin <= end)
+    {
+        std::size_t end_line = chunk.find('\n', begin);
+        std::string line = chunk.substr(begin, end_line - begin);
+        begin = end_line + 1;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.empty())
+        {
+            std::clog << "[Warn] File will not be processed any further due to an empty line" << std::endl;
+            follow.stopped = true;
+            break;
+        }
+        if (follow.first_line.empty())
+            follow.first_line = line;
+
+        std::vector<double> row;
+        _processLine(line, [&row] (std::string number)
+            {
+                row.push_back(std::atof(number.c_str()));
+            });
+        unsigned int n_cols = (n_joints > 0) ? n_joints + 3 : (values.empty() ? row.size() : values[0].size());
+        if (n_cols == 1)
+        {
+            std::cerr << "[Error] No columns were detected. Check if the delimiter has been chosen correctly." << std::endl;
+            this->clear();
+            return false;
+        }
+        if (row.size() != n_cols)
+        {
+            std::clog << "[Warn] Skipping line with " << row.size() << " columns when " << n_cols << " were expected." << std::endl;
+            continue;
+        }
+        values.push_back(row);
+    }
+
+    Data rows(values.size(), values.empty() ? 0 : values[0].size());
+    for (unsigned int k = 0; k < values.size(); ++k)
+        rows.row(k) = Eigen::Map<const Eigen::RowVectorXd>(values[k].data(), values[k].size());
+    this->_appendRows(rows);
+
+    return ok_data;
 }
 
 bool DataParser::readFile(const std::string &fname)
@@ -208,6 +445,73 @@ bool DataParser::readFile(const std::string &fname)
     return this->_configureDataMatrices();
 }
 
+bool DataParser::openSharedMemory(const std::string &name)
+{
+#ifdef AXES_IDENT_SHARED_MEMORY
+    this->clear();
+    ring = std::make_shared<SharedMemoryRing>();
+    if (!ring->open(name))
+    {
+        ring.reset();
+        return false;
+    }
+    // Start from the oldest sample still in the ring
+    std::uint64_t write_sequence = ring->getWriteSequence();
+    ring_sequence = (write_sequence > ring->getCapacity()) ? write_sequence - ring->getCapacity() : 0;
+    n_lost_samples = ring_sequence;
+    // A call never reads more samples than the ring holds, so the staging rows are allocated once
+    ring_rows.resize(ring->getCapacity(), ring->getNJoints() + 3);
+    return true;
+#else
+    (void) name;
+    std::cerr << "[Error] Shared memory rings are only available on POSIX systems." << std::endl;
+    return false;
+#endif
+}
+
+bool DataParser::readSharedMemory()
+{
+#ifdef AXES_IDENT_SHARED_MEMORY
+    if (!ring)
+    {
+        std::cerr << "[Error] No shared memory ring is mapped." << std::endl;
+        return false;
+    }
+    std::uint64_t write_sequence = ring->getWriteSequence();
+    // A restarted producer creates a new ring, looked up by name only while the mapped one is idle
+    if (write_sequence < ring_sequence || !ring->hasValidHeader() ||
+        (write_sequence == ring_sequence && ring->isReplaced()))
+    {
+        std::clog << "[Warn] Shared memory ring was restarted. Reading it from the start." << std::endl;
+        const std::string name = ring->getName();
+        if (!this->openSharedMemory(name))
+            return false;
+        write_sequence = ring->getWriteSequence();
+    }
+    if (write_sequence - ring_sequence > ring->getCapacity())
+    {
+        n_lost_samples += write_sequence - ring->getCapacity() - ring_sequence;
+        ring_sequence = write_sequence - ring->getCapacity();
+    }
+
+    // Samples are validated against their sequence numbers while being copied to the staging rows
+    unsigned int n_rows = 0;
+    for (; ring_sequence < write_sequence; ++ring_sequence)
+    {
+        if (ring->read(ring_sequence, ring_rows.row(n_rows).data()))
+            ++n_rows;
+        else
+            ++n_lost_samples;
+    }
+    this->_appendRows(ring_rows.topRows(n_rows));
+
+    return ok_data;
+#else
+    std::cerr << "[Error] No shared memory ring is mapped." << std::endl;
+    return false;
+#endif
+}
+
 bool DataParser::readData(const Data &data_user)
 {
     data = data_user;
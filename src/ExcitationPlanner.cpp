@@ -0,0 +1,116 @@
+#include "ExcitationPlanner.hpp"
+#include <iostream>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+
+using namespace axes_ident;
+
+ExcitationPlanner::ExcitationPlanner(const Identification &ident, const DataParser &parser) :
+    ident(ident), n_joints(ident.getNJoints()),
+    lower_limits(Eigen::VectorXd::Constant(n_joints, -std::numeric_limits<double>::infinity())),
+    upper_limits(Eigen::VectorXd::Constant(n_joints, std::numeric_limits<double>::infinity())),
+    max_amplitude(ExcitationPlanner::DEFAULT_MAX_AMPLITUDE),
+    tol_min_movement(parser.getToleranceMinMovement()),
+    tol_max_stall_movement(parser.getToleranceStall()),
+    prior_information(ExcitationPlanner::DEFAULT_PRIOR_INFORMATION),
+    n_amplitudes(ExcitationPlanner::DEFAULT_N_AMPLITUDES)
+{
+}
+
+void ExcitationPlanner::setJointLimits(const Eigen::VectorXd &lower, const Eigen::VectorXd &upper)
+{
+    if (lower.size() != n_joints || upper.size() != n_joints)
+    {
+        std::cerr << "[Error] Joint limits should have " << n_joints << " elements. Limits were not changed." << std::endl;
+        return;
+    }
+    lower_limits = lower;
+    upper_limits = upper;
+}
+
+void ExcitationPlanner::setMaxAmplitude(double val)
+{
+    val = std::abs(val);
+    if (val > M_PI)
+    {
+        std::cerr << "[Warn] Move amplitude larger than pi. Changing from " << val << " to " << M_PI << '.' << std::endl;
+        val = M_PI;
+    }
+    max_amplitude = val;
+}
+
+void ExcitationPlanner::setTolerances(const DataParser &parser)
+{
+    tol_min_movement = parser.getToleranceMinMovement();
+    tol_max_stall_movement = parser.getToleranceStall();
+}
+
+double ExcitationPlanner::_computeInformation(const Eigen::Matrix<double, 3, Eigen::Dynamic> &axes, bool start_from_last)
+{
+    double cost = ident.computeInformation(workspace, axes, information, start_from_last);
+    information.diagonal().array() += prior_information;
+    //
+    unsigned int n_experiments = 0;
+    for (unsigned int k = 0; k < n_joints; ++k)
+        n_experiments += ident.getNExperiments(k);
+    // Each experiment measures the 9 entries of a rotation matrix
+    int dof = 9 * (int) n_experiments - 2 * (int) n_joints;
+    return (dof > 0 && cost > 0) ? cost / dof : 1;
+}
+
+double ExcitationPlanner::_traceInverse(const Eigen::MatrixXd &information)
+{
+    ldlt.compute(information);
+    return ldlt.solve(Eigen::MatrixXd::Identity(information.rows(), information.cols())).trace();
+}
+
+double ExcitationPlanner::computeUncertainty(const Eigen::Matrix<double, 3, Eigen::Dynamic> &axes, bool start_from_last)
+{
+    double noise_variance = this->_computeInformation(axes, start_from_last);
+    return noise_variance * this->_traceInverse(information);
+}
+
+ExcitationPlanner::Move ExcitationPlanner::planNextMove(const Eigen::VectorXd &theta,
+    const Eigen::Matrix<double, 3, Eigen::Dynamic> &axes, bool start_from_last)
+{
+    Move best;
+    best.joint = DataParser::INDEX_INVALID;
+    best.delta_angle = 0;
+    best.uncertainty = std::numeric_limits<double>::infinity();
+    if (theta.size() != n_joints || axes.cols() != n_joints)
+    {
+        std::cerr << "[Error] Expected " << n_joints << " joint angles and axes. No move was planned." << std::endl;
+        return best;
+    }
+    //
+    double noise_variance = this->_computeInformation(axes, start_from_last);
+    // The moving joint must stand out from the drift of the others to be classified correctly
+    const double min_amplitude = std::max(tol_min_movement, tol_max_stall_movement);
+    Eigen::VectorXd theta_next;
+    for (unsigned int joint = 0; joint < n_joints; ++joint)
+    {
+        double direction = (upper_limits(joint) - theta(joint) >= theta(joint) - lower_limits(joint)) ? 1 : -1;
+        for (unsigned int k = 1; k <= n_amplitudes; ++k)
+        {
+            double delta_angle = direction * max_amplitude * k / n_amplitudes;
+            theta_next = theta;
+            theta_next(joint) += delta_angle;
+            if (std::abs(delta_angle) <= min_amplitude ||
+                theta_next(joint) < lower_limits(joint) || theta_next(joint) > upper_limits(joint))
+                continue;
+            //
+            ident.computeExperimentJacobian(workspace, axes, theta_next, joint, delta_angle, J, start_from_last);
+            information_candidate = information;
+            information_candidate.noalias() += J.transpose() * J;
+            double uncertainty = noise_variance * this->_traceInverse(information_candidate);
+            if (uncertainty < best.uncertainty)
+            {
+                best.joint = joint;
+                best.delta_angle = delta_angle;
+                best.uncertainty = uncertainty;
+            }
+        }
+    }
+    return best;
+}
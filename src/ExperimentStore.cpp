@@ -0,0 +1,201 @@
+#include "ExperimentStore.hpp"
+
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <limits>
+
+using namespace axes_ident;
+
+namespace
+{
+template <typename T>
+inline void readValue(const unsigned char *bytes, std::size_t &offset, T &value)
+{
+    std::memcpy(&value, bytes + offset, sizeof(T));
+    offset += sizeof(T);
+}
+}
+
+ExperimentStore::ExperimentStore() :
+    n_joints(0), tol_quantization(0), keyframe_interval(DEFAULT_KEYFRAME_INTERVAL), n_records(0)
+{
+}
+
+void ExperimentStore::reset(unsigned int n_joints, double tol_quantization, unsigned int keyframe_interval)
+{
+    if (tol_quantization < 0)
+    {
+        std::cerr << "[Error] Negative tolerance value. Changing from " << tol_quantization <<
+            " to " << (-tol_quantization) << '.' << std::endl;
+        tol_quantization = -tol_quantization;
+    }
+    if (keyframe_interval == 0)
+    {
+        std::cerr << "[Error] Keyframe interval should be positive. Changing it to 1." << std::endl;
+        keyframe_interval = 1;
+    }
+    this->n_joints = n_joints;
+    this->tol_quantization = tol_quantization;
+    this->keyframe_interval = keyframe_interval;
+    buffer.clear();
+    keyframes.clear();
+    keyframe_experiments.clear();
+    n_experiments.assign(n_joints, 0);
+    n_records = 0;
+    theta_reference.setZero(n_joints);
+    rpy_reference.setZero();
+}
+
+void ExperimentStore::append(unsigned int joint, const Eigen::Ref<const Eigen::RowVectorXd> &row_last,
+    const Eigen::Ref<const Eigen::RowVectorXd> &row_curr)
+{
+    const double step = 2 * tol_quantization;
+    bool keyframe = (n_records % keyframe_interval == 0);
+    // Quantized changes that do not fit the record are stored in a keyframe instead
+    for (unsigned int k = 0; !keyframe && step > 0 && k < n_joints; ++k)
+    {
+        keyframe = (k != joint) &&
+            std::abs(std::round((row_curr(k) - theta_reference(k)) / step)) > std::numeric_limits<std::int16_t>::max();
+    }
+
+    unsigned char flags = keyframe ? (KEYFRAME | LAST_ORIENTATION | DELTA_ANGLE) : 0;
+    // The delta angle and the last orientation usually follow from the previous record
+    double delta_angle = row_curr(joint) - row_last(joint);
+    if (row_curr(joint) - theta_reference(joint) != delta_angle)
+        flags |= DELTA_ANGLE;
+    if (row_last.segment<3>(n_joints) != rpy_reference.transpose())
+        flags |= LAST_ORIENTATION;
+
+    if (keyframe)
+    {
+        keyframes.push_back(buffer.size());
+        keyframe_experiments.insert(keyframe_experiments.end(), n_experiments.begin(), n_experiments.end());
+    }
+    this->_write(flags);
+    this->_write(static_cast<std::uint16_t>(joint));
+    if (keyframe)
+    {
+        theta_reference = row_curr.head(n_joints).transpose();
+        for (unsigned int k = 0; k < n_joints; ++k)
+            this->_write(theta_reference(k));
+    }
+    else
+    {
+        theta_reference(joint) = row_curr(joint);
+        this->_write(theta_reference(joint));
+        // Joints that did not move are flagged in a bitmask and followed by their new values
+        std::size_t ind_bitmask = buffer.size();
+        buffer.resize(buffer.size() + this->_bitmaskSize(), 0);
+        for (unsigned int k = 0; k < n_joints; ++k)
+        {
+            if (k == joint || row_curr(k) == theta_reference(k))
+                continue;
+            if (step > 0)
+            {
+                std::int16_t count = std::round((row_curr(k) - theta_reference(k)) / step);
+                if (count == 0)
+                    continue;
+                theta_reference(k) += count * step;
+                this->_write(count);
+            }
+            else
+            {
+                theta_reference(k) = row_curr(k);
+                this->_write(theta_reference(k));
+            }
+            buffer[ind_bitmask + k / 8] |= (1u << (k % 8));
+        }
+    }
+    if (flags & DELTA_ANGLE)
+        this->_write(delta_angle);
+    if (flags & LAST_ORIENTATION)
+    {
+        for (unsigned int k = 0; k < 3; ++k)
+            this->_write(row_last(n_joints + k));
+    }
+    rpy_reference = row_curr.segment<3>(n_joints).transpose();
+    for (unsigned int k = 0; k < 3; ++k)
+        this->_write(rpy_reference(k));
+
+    ++n_records;
+    ++n_experiments[joint];
+}
+
+ExperimentStore::Decoder::Decoder() :
+    store(nullptr), offset(0), offset_end(0)
+{
+}
+
+void ExperimentStore::Decoder::reset(const ExperimentStore &store, unsigned int ind_keyframe, unsigned int ind_keyframe_end)
+{
+    this->store = &store;
+    offset = (ind_keyframe < store.keyframes.size()) ? store.keyframes[ind_keyframe] : store.buffer.size();
+    offset_end = (ind_keyframe_end < store.keyframes.size()) ? store.keyframes[ind_keyframe_end] : store.buffer.size();
+    n_experiments.resize(store.n_joints);
+    for (unsigned int k = 0; k < store.n_joints; ++k)
+    {
+        n_experiments[k] = (ind_keyframe < store.keyframes.size()) ?
+            store.keyframe_experiments[ind_keyframe * store.n_joints + k] : store.n_experiments[k];
+    }
+    record.theta.resize(store.n_joints);
+}
+
+bool ExperimentStore::Decoder::next()
+{
+    if (store == nullptr || offset >= offset_end)
+        return false;
+
+    const unsigned char *bytes = store->buffer.data();
+    const unsigned int n_joints = store->n_joints;
+    const double step = 2 * store->tol_quantization;
+    unsigned char flags;
+    std::uint16_t joint;
+    readValue(bytes, offset, flags);
+    readValue(bytes, offset, joint);
+    record.joint = joint;
+    record.ind_experiment = n_experiments[joint]++;
+    if (flags & KEYFRAME)
+    {
+        std::memcpy(record.theta.data(), bytes + offset, n_joints * sizeof(double));
+        offset += n_joints * sizeof(double);
+    }
+    else
+    {
+        double theta_joint;
+        readValue(bytes, offset, theta_joint);
+        record.delta_angle = theta_joint - record.theta(joint);
+        record.theta(joint) = theta_joint;
+        const unsigned char *bitmask = bytes + offset;
+        offset += store->_bitmaskSize();
+        for (unsigned int k = 0; k < n_joints; ++k)
+        {
+            if (!(bitmask[k / 8] & (1u << (k % 8))))
+                continue;
+            if (step > 0)
+            {
+                std::int16_t count;
+                readValue(bytes, offset, count);
+                record.theta(k) += count * step;
+            }
+            else
+            {
+                readValue(bytes, offset, record.theta(k));
+            }
+        }
+    }
+    if (flags & DELTA_ANGLE)
+        readValue(bytes, offset, record.delta_angle);
+    if (flags & LAST_ORIENTATION)
+    {
+        for (unsigned int k = 0; k < 3; ++k)
+            readValue(bytes, offset, record.rpy_last(k));
+    }
+    else
+    {
+        record.rpy_last = record.rpy_curr;
+    }
+    for (unsigned int k = 0; k < 3; ++k)
+        readValue(bytes, offset, record.rpy_curr(k));
+    return true;
+}
@@ -2,11 +2,18 @@
 #include <iostream>
 #include <algorithm>
 #include <numeric>
+#include <cmath>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace axes_ident;
 
 Identification::Identification(unsigned int n_joints) :
-    n_joints(n_joints)
+    n_joints(n_joints), estimator(Estimator::MEAN),
+    tol_huber(DEFAULT_HUBER_THRESHOLD), tol_rejection(DEFAULT_REJECTION_THRESHOLD),
+    robust_max_iterations(DEFAULT_ROBUST_MAX_ITERATIONS), tol_robust(DEFAULT_ROBUST_TOLERANCE)
 {
     this->_resizeAxes(n_joints);
 }
@@ -22,6 +29,40 @@ bool Identification::_checkNJoints()
     return this->n_joints >= 1;
 }
 
+void Identification::setEstimator(Estimator estimator, double tol_huber, double tol_rejection,
+    unsigned int max_iterations, double tol)
+{
+    // Thresholds are multiples of the median residual, below one they would affect most experiments
+    if (!(tol_huber >= 1) || !(tol_rejection >= 1))
+    {
+        std::cerr << "[Error] Estimator thresholds should be at least 1. Using the defaults." << std::endl;
+        tol_huber = DEFAULT_HUBER_THRESHOLD;
+        tol_rejection = DEFAULT_REJECTION_THRESHOLD;
+    }
+    if (tol_rejection < tol_huber)
+    {
+        std::clog << "[Warn] Rejection threshold " << tol_rejection << " is below the Huber threshold. Changing it to " <<
+            tol_huber << '.' << std::endl;
+        tol_rejection = tol_huber;
+    }
+    this->estimator = estimator;
+    if (max_iterations == 0)
+    {
+        std::cerr << "[Error] Estimator should run at least one iteration. Changing it to 1." << std::endl;
+        max_iterations = 1;
+    }
+    if (tol < 0)
+    {
+        std::cerr << "[Error] Negative tolerance value. Changing from " << tol <<
+            " to " << (-tol) << '.' << std::endl;
+        tol = -tol;
+    }
+    this->tol_huber = tol_huber;
+    this->tol_rejection = tol_rejection;
+    this->robust_max_iterations = max_iterations;
+    this->tol_robust = tol;
+}
+
 bool Identification::setData(const DataParser &parser)
 {
     if (!this->_checkNJoints())
@@ -34,79 +75,136 @@ bool Identification::setData(const DataParser &parser)
         std::cerr << "[Error] Parser contains errors. Identification algorithm was not configured." << std::endl;
         return false;
     }
-    const DataParser::Data &data = parser.getDataByJoint()[0];
-    if (data.cols() != n_joints + 4)
+    // Parsers that only keep the compact storage are streamed from their experiment store
+    const std::vector<Eigen::Ref<const DataParser::Data>> data_by_joint = parser.getDataByJoint();
+    const ExperimentStore &store = parser.getExperimentStore();
+    bool compact = data_by_joint.empty();
+    unsigned int n_cols = compact ? store.getNJoints() + 4 : data_by_joint[0].cols();
+    unsigned int n_rows = compact ? 2 * store.getNExperiments(0) : data_by_joint[0].rows();
+    if (n_cols != n_joints + 4)
     {
-        std::cerr << "[Error] Data columns = " << data.cols() << " , but " <<
+        std::cerr << "[Error] Data columns = " << n_cols << " , but " <<
             n_joints + 4 << " were expected." << std::endl;
         return false;
     }
-    if (data.rows() < 2)
+    if (n_rows < 2)
     {
         std::cerr << "[Error] Data should contain at least 2 rows." << std::endl;
         return false;
     }
-    else if (data.rows() < n_joints + 1)
+    else if (n_rows < n_joints + 1)
     {
-        std::cerr << "[Warn] Not enough rows, received " << data.rows() << " when at least " <<
+        std::cerr << "[Warn] Not enough rows, received " << n_rows << " when at least " <<
             n_joints + 1 << " were expected. Not all axes will be identified." << std::endl;
     }
     
-    this->data = parser.getDataByJoint();
+    if (compact)
+    {
+        this->store = store;
+        this->data.clear();
+    }
+    else
+    {
+        this->data.assign(data_by_joint.begin(), data_by_joint.end());
+        this->store.reset(0);
+    }
+    return true;
+}
+
+bool Identification::updateData(const DataParser &parser)
+{
+    const std::vector<Eigen::Ref<const DataParser::Data>> data_parser = parser.getDataByJoint();
+    bool is_prefix = parser.check() && data.size() == n_joints && data_parser.size() == n_joints;
+    for (unsigned int k = 0; is_prefix && k < n_joints; ++k)
+    {
+        unsigned int n_rows = data[k].rows();
+        is_prefix = data_parser[k].cols() == data[k].cols() && data_parser[k].rows() >= n_rows
+            && (n_rows == 0 || data_parser[k].row(n_rows - 1) == data[k].row(n_rows - 1));
+    }
+    if (!is_prefix)
+        return this->setData(parser);
+
+    for (unsigned int k = 0; k < n_joints; ++k)
+    {
+        unsigned int n_rows = data[k].rows();
+        unsigned int n_new_rows = data_parser[k].rows() - n_rows;
+        data[k].conservativeResize(n_rows + n_new_rows, Eigen::NoChange);
+        data[k].bottomRows(n_new_rows) = data_parser[k].bottomRows(n_new_rows);
+    }
     return true;
 }
 
-Eigen::Matrix<double, 3, Eigen::Dynamic> Identification::identifyAxes(bool start_from_last)
+template <typename Callback>
+void Identification::_forEachExperiment(Workspace &workspace, unsigned int joint, Callback callback) const
+{
+    if (data.empty())
+    {
+        // Records of every joint are interleaved, so the whole store is decoded
+        ExperimentStore::Decoder &decoder = workspace.decoder;
+        const ExperimentStore::Record &record = decoder.getRecord();
+        decoder.reset(store);
+        while (decoder.next())
+        {
+            if (record.joint == joint)
+                callback(record.ind_experiment, record.theta, record.delta_angle, record.rpy_last, record.rpy_curr);
+        }
+        return;
+    }
+    const DataParser::Data &rows = data[joint];
+    for (unsigned int ind_exp = 0; 2 * ind_exp + 1 < rows.rows(); ++ind_exp)
+    {
+        auto row_last = rows.row(2 * ind_exp);
+        auto row_curr = rows.row(2 * ind_exp + 1);
+        callback(ind_exp, row_curr.head(n_joints).transpose(), row_curr(joint) - row_last(joint),
+            row_last.segment<3>(n_joints).transpose(), row_curr.segment<3>(n_joints).transpose());
+    }
+}
+
+const Eigen::Matrix<double, 3, Eigen::Dynamic> & Identification::identifyAxes(Workspace &workspace,
+    bool start_from_last, bool refine) const
 {
     // Housekeeping before main algorithm
     auto I = Eigen::Matrix3d::Identity();
     //
-    unsigned int ind_data_roll = n_joints;
-    unsigned int ind_data_pitch = ind_data_roll + 1;
-    unsigned int ind_data_yaw = ind_data_pitch + 1;
-    //
-    auto rotRPY = [ind_data_roll, ind_data_pitch, ind_data_yaw] (const Eigen::RowVectorXd &row) -> Eigen::Matrix3d
+    auto rotRPY = [] (const Eigen::Ref<const Eigen::Vector3d> &rpy) -> Eigen::Matrix3d
     {
-        return HelperFunctions::rotRPY<double>(
-            row(ind_data_roll),
-            row(ind_data_pitch),
-            row(ind_data_yaw),
-            false
-        );
+        return HelperFunctions::rotRPY<double>(rpy(0), rpy(1), rpy(2), false);
     };
     //
-    Eigen::Matrix<double, 3, Eigen::Dynamic> axes(3, n_joints);
-    Eigen::Matrix<double, 3, Eigen::Dynamic> axes_measurements[n_joints];
+    Eigen::Matrix<double, 3, Eigen::Dynamic> &axes = workspace.axes;
+    std::vector<Eigen::Matrix<double, 3, Eigen::Dynamic>> &axes_measurements = workspace.axes_measurements;
+    std::vector<Eigen::VectorXd> &axes_weights = workspace.axes_weights;
+    axes.resize(3, n_joints);
+    axes_measurements.resize(n_joints);
+    axes_weights.resize(n_joints);
+    workspace.n_rejected.assign(n_joints, 0);
     for (unsigned int k = 0; k < n_joints; ++k)
     {
-        axes_measurements[k].resize(3, data[k].rows() / 2);
+        axes_measurements[k].resize(3, this->getNExperiments(k));
+        axes_weights[k].resize(this->getNExperiments(k));
     }
     //
-    std::vector<unsigned int> ind_joint_order(n_joints);
-    std::iota(ind_joint_order.begin(), ind_joint_order.end(), 0);
-    if (start_from_last)
-        std::reverse(ind_joint_order.begin(), ind_joint_order.end());
+    std::vector<unsigned int> &ind_joint_order = workspace.ind_joint_order;
+    this->_jointOrder(ind_joint_order, start_from_last);
     //
     unsigned int counter = 0;
     while (counter < n_joints)
     {
         unsigned int ind_joint = ind_joint_order[counter];
-        const DataParser::Data &experiments = data[ind_joint];
-        for (unsigned int ind_exp = 0; ind_exp < experiments.rows(); ind_exp += 2)
+        this->_forEachExperiment(workspace, ind_joint, [&] (unsigned int ind_exp,
+            const Eigen::Ref<const Eigen::VectorXd> &theta, double delta_angle_ji,
+            const Eigen::Ref<const Eigen::Vector3d> &rpy_last, const Eigen::Ref<const Eigen::Vector3d> &rpy_curr)
         {
-            const Eigen::RowVectorXd &row_last = experiments.row(ind_exp);
-            const Eigen::RowVectorXd &row_curr = experiments.row(ind_exp+1);
-            //
-            auto Rwe_last = rotRPY(row_last);
-            auto Rwe_curr = rotRPY(row_curr);
+            auto Rwe_last = rotRPY(rpy_last);
+            auto Rwe_curr = rotRPY(rpy_curr);
             //
             Eigen::Matrix3d R = I;
             for (auto iter_other = ind_joint_order.begin() ; iter_other < ind_joint_order.begin() + counter ; ++iter_other)
             {
                 if (start_from_last)
-                    R = HelperFunctions::rotAngleAxis<double>(row_curr(*iter_other), axes.col(*iter_other)) * R;
+                    R = HelperFunctions::rotAngleAxis<double>(theta(*iter_other), axes.col(*iter_other)) * R;
                 else
-                    R = R * HelperFunctions::rotAngleAxis<double>(row_curr(*iter_other), axes.col(*iter_other));
+                    R = R * HelperFunctions::rotAngleAxis<double>(theta(*iter_other), axes.col(*iter_other));
             }
             //
             if (start_from_last)
@@ -114,13 +212,461 @@ Eigen::Matrix<double, 3, Eigen::Dynamic> Identification::identifyAxes(bool start
             else
                 R = R.transpose() * Rwe_curr * Rwe_last.transpose() * R;
             //
-            double delta_angle_ji = row_curr(ind_joint) - row_last(ind_joint);
-            //
-            axes_measurements[ind_joint].col(ind_exp / 2) = HelperFunctions::axisFromRot<double>(R, delta_angle_ji);
-        }
-        axes.col(ind_joint) = axes_measurements[ind_joint].rowwise().mean().normalized();
+            axes_measurements[ind_joint].col(ind_exp) = HelperFunctions::axisFromRot<double>(R, delta_angle_ji);
+            axes_weights[ind_joint](ind_exp) = std::pow(std::sin(delta_angle_ji), 2);
+        });
+        axes.col(ind_joint) = this->_estimateAxis(workspace, ind_joint);
         //
         ++counter;
     }
+    if (refine)
+        this->_refineAxes(workspace, start_from_last, DEFAULT_REFINEMENT_MAX_ITERATIONS, DEFAULT_REFINEMENT_TOLERANCE,
+            estimator != Estimator::MEAN);
     return axes;
-}
\ No newline at end of file
+}
+
+Eigen::Vector3d Identification::_estimateAxis(Workspace &workspace, unsigned int joint) const
+{
+    const Eigen::Matrix<double, 3, Eigen::Dynamic> &measurements = workspace.axes_measurements[joint];
+    if (estimator == Estimator::MEAN)
+        return measurements.rowwise().mean().normalized();
+
+    // axisFromRot divides the measurement noise by sin(delta_angle), so the squared sine weights
+    // each experiment by the inverse of its variance. Moves of about pi give useless measurements.
+    Eigen::VectorXd &weights = workspace.axes_weights[joint];
+    unsigned int &n_rejected = workspace.n_rejected[joint];
+    const unsigned int n_experiments = measurements.cols();
+    for (unsigned int k = 0; k < n_experiments; ++k)
+    {
+        if (!(weights(k) > 0) || !std::isfinite(weights(k)) || !measurements.col(k).allFinite())
+        {
+            weights(k) = 0;
+            ++n_rejected;
+        }
+    }
+    // Normalizing makes dividing by the sum of the weights unnecessary
+    auto weightedMean = [&measurements, n_experiments] (const double *w) -> Eigen::Vector3d
+    {
+        Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+        for (unsigned int k = 0; k < n_experiments; ++k)
+        {
+            if (w[k] > 0)
+                sum += w[k] * measurements.col(k);
+        }
+        return sum.normalized();
+    };
+    if (estimator == Estimator::WEIGHTED_MEAN)
+        return weightedMean(weights.data());
+
+    std::vector<double> &residuals = workspace.residuals;
+    std::vector<double> &robust_weights = workspace.robust_weights;
+    std::vector<double> &sorted = workspace.sorted;
+    residuals.resize(n_experiments);
+    robust_weights.resize(n_experiments);
+    auto median = [&sorted] () -> double
+    {
+        auto middle = sorted.begin() + sorted.size() / 2;
+        std::nth_element(sorted.begin(), middle, sorted.end());
+        return *middle;
+    };
+    // The coordinate-wise median is a starting point unaffected by up to half of the experiments
+    Eigen::Vector3d axis;
+    for (unsigned int c = 0; c < 3; ++c)
+    {
+        sorted.clear();
+        for (unsigned int k = 0; k < n_experiments; ++k)
+        {
+            if (weights(k) > 0)
+                sorted.push_back(measurements(c, k));
+        }
+        if (sorted.empty())
+            return weightedMean(weights.data());
+        axis(c) = median();
+    }
+    axis.normalize();
+    // Iteratively reweighted mean, each iteration is linear in the number of experiments
+    for (unsigned int iter = 0; iter < robust_max_iterations; ++iter)
+    {
+        // Residuals are scaled back by sin(delta_angle) so that every experiment has the same noise
+        sorted.clear();
+        for (unsigned int k = 0; k < n_experiments; ++k)
+        {
+            if (weights(k) > 0)
+            {
+                residuals[k] = std::sqrt(weights(k)) * (measurements.col(k) - axis).norm();
+                sorted.push_back(residuals[k]);
+            }
+        }
+        double scale = median();
+        for (unsigned int k = 0; k < n_experiments; ++k)
+        {
+            if (weights(k) == 0 || residuals[k] > tol_rejection * scale)
+                robust_weights[k] = 0;
+            else if (residuals[k] <= tol_huber * scale)
+                robust_weights[k] = weights(k);
+            else
+                robust_weights[k] = weights(k) * tol_huber * scale / residuals[k];
+        }
+        Eigen::Vector3d axis_new = weightedMean(robust_weights.data());
+        double step = (axis_new - axis).norm();
+        axis = axis_new;
+        if (step <= tol_robust)
+            break;
+    }
+    for (unsigned int k = 0; k < n_experiments; ++k)
+    {
+        if (weights(k) > 0 && robust_weights[k] == 0)
+        {
+            weights(k) = 0;
+            ++n_rejected;
+        }
+    }
+    return axis;
+}
+
+Eigen::Matrix<double, 3, Eigen::Dynamic> Identification::identifyAxes(bool start_from_last, bool refine) const
+{
+    Workspace workspace;
+    return this->identifyAxes(workspace, start_from_last, refine);
+}
+
+void Identification::_jointOrder(std::vector<unsigned int> &ind_joint_order, bool start_from_last) const
+{
+    ind_joint_order.resize(n_joints);
+    std::iota(ind_joint_order.begin(), ind_joint_order.end(), 0);
+    if (start_from_last)
+        std::reverse(ind_joint_order.begin(), ind_joint_order.end());
+}
+
+void Identification::_setExperiment(Experiment &experiment, unsigned int ind_order, double delta_angle,
+    const Eigen::Ref<const Eigen::VectorXd> &theta, const Eigen::Ref<const Eigen::Vector3d> &rpy_last,
+    const Eigen::Ref<const Eigen::Vector3d> &rpy_curr, bool start_from_last) const
+{
+    auto Rwe_last = HelperFunctions::rotRPY<double>(rpy_last(0), rpy_last(1), rpy_last(2), false);
+    auto Rwe_curr = HelperFunctions::rotRPY<double>(rpy_curr(0), rpy_curr(1), rpy_curr(2), false);
+    //
+    experiment.ind_order = ind_order;
+    experiment.delta_angle = delta_angle;
+    experiment.theta = theta;
+    if (start_from_last)
+        experiment.R = Rwe_last.transpose() * Rwe_curr;
+    else
+        experiment.R = Rwe_curr * Rwe_last.transpose();
+}
+
+void Identification::_prepareExperiments(Workspace &workspace, bool start_from_last, bool skip_rejected) const
+{
+    std::vector<unsigned int> &ind_joint_order = workspace.ind_joint_order;
+    this->_jointOrder(ind_joint_order, start_from_last);
+    workspace.ind_order.resize(n_joints);
+    for (unsigned int c = 0; c < n_joints; ++c)
+        workspace.ind_order[ind_joint_order[c]] = c;
+    workspace.n_experiments = 0;
+    for (unsigned int k = 0; k < n_joints; ++k)
+        workspace.n_experiments += this->getNExperiments(k) - (skip_rejected ? workspace.n_rejected[k] : 0);
+    workspace.skip_rejected = skip_rejected;
+    if (data.empty())
+        return;
+    // Elements are overwritten rather than recreated, so their buffers are reused
+    std::vector<Experiment> &experiments = workspace.experiments;
+    experiments.resize(workspace.n_experiments);
+    //
+    unsigned int ind_experiment = 0;
+    for (unsigned int counter = 0; counter < n_joints; ++counter)
+    {
+        unsigned int ind_joint = ind_joint_order[counter];
+        this->_forEachExperiment(workspace, ind_joint, [&] (unsigned int ind_exp,
+            const Eigen::Ref<const Eigen::VectorXd> &theta, double delta_angle,
+            const Eigen::Ref<const Eigen::Vector3d> &rpy_last, const Eigen::Ref<const Eigen::Vector3d> &rpy_curr)
+        {
+            if (skip_rejected && workspace.axes_weights[ind_joint](ind_exp) == 0)
+                return;
+            this->_setExperiment(experiments[ind_experiment++], counter, delta_angle, theta, rpy_last, rpy_curr,
+                start_from_last);
+        });
+    }
+}
+
+Eigen::Matrix3d Identification::_experimentResidual(const Experiment &experiment,
+    const Eigen::Matrix<double, 3, Eigen::Dynamic> &axes, bool start_from_last,
+    const std::vector<unsigned int> &ind_joint_order, const std::vector<Eigen::Matrix<double, 3, 2>> &basis,
+    Workspace::ThreadScratch &scratch, bool with_jacobian) const
+{
+    // The measured rotation is brought to the frame of the moving joint by
+    // Q = G_{c-1} * ... * G_0, where G_i is a rotation about the i-th identified
+    // axis, inverted when the chain starts from the first joint (see identifyAxes)
+    const double sign = start_from_last ? 1 : -1;
+    const unsigned int c = experiment.ind_order;
+    const unsigned int ind_joint = ind_joint_order[c];
+    std::vector<Eigen::Matrix3d> &G = scratch.G;
+    std::vector<Eigen::Matrix3d> &Q_partial = scratch.Q_partial;
+    Eigen::Matrix<double, 9, Eigen::Dynamic> &J = scratch.J;
+    //
+    Q_partial[0].setIdentity();
+    for (unsigned int i = 0; i < c; ++i)
+    {
+        unsigned int ind_other = ind_joint_order[i];
+        G[i] = HelperFunctions::rotAngleAxis<double>(sign * experiment.theta(ind_other), axes.col(ind_other));
+        Q_partial[i+1] = G[i] * Q_partial[i];
+    }
+    const Eigen::Matrix3d &Q = Q_partial[c];
+    Eigen::Matrix3d E = Q * experiment.R * Q.transpose()
+        - HelperFunctions::rotAngleAxis<double>(experiment.delta_angle, axes.col(ind_joint));
+    if (!with_jacobian)
+        return E;
+    //
+    const Eigen::Matrix3d QR = Q * experiment.R;
+    const Eigen::Matrix3d RQt = experiment.R * Q.transpose();
+    Eigen::Matrix3d L = Eigen::Matrix3d::Identity();
+    for (int i = (int) c - 1; i >= 0; --i)
+    {
+        unsigned int ind_other = ind_joint_order[i];
+        double phi = sign * experiment.theta(ind_other);
+        for (unsigned int t = 0; t < 2; ++t)
+        {
+            Eigen::Matrix3d dQ = L * HelperFunctions::dRotAngleAxis<double>(phi, axes.col(ind_other), basis[i].col(t)) * Q_partial[i];
+            Eigen::Matrix3d dE = dQ * RQt + QR * dQ.transpose();
+            J.col(2*i + t) = Eigen::Map<const Eigen::Matrix<double, 9, 1>>(dE.data());
+        }
+        L = L * G[i];
+    }
+    for (unsigned int t = 0; t < 2; ++t)
+    {
+        Eigen::Matrix3d dE = -HelperFunctions::dRotAngleAxis<double>(experiment.delta_angle, axes.col(ind_joint), basis[c].col(t));
+        J.col(2*c + t) = Eigen::Map<const Eigen::Matrix<double, 9, 1>>(dE.data());
+    }
+    return E;
+}
+
+double Identification::_accumulateNormalEquations(Workspace &workspace, const Eigen::Matrix<double, 3, Eigen::Dynamic> &axes,
+    bool start_from_last, bool with_jacobian) const
+{
+    const unsigned int n_unknowns = 2 * n_joints;
+    const std::vector<Experiment> &experiments = workspace.experiments;
+    const std::vector<unsigned int> &ind_joint_order = workspace.ind_joint_order;
+    //
+    std::vector<Eigen::Matrix<double, 3, 2>> &basis = workspace.basis;
+    basis.resize(n_joints);
+    for (unsigned int k = 0; k < n_joints; ++k)
+        basis[k] = HelperFunctions::tangentBasis<double>(axes.col(ind_joint_order[k]));
+    //
+    // Each thread accumulates into its own scratch, which are summed in a fixed order afterwards
+#ifdef _OPENMP
+    const int n_threads = omp_get_max_threads();
+#else
+    const int n_threads = 1;
+#endif
+    if (workspace.threads.size() < (std::size_t) n_threads)
+        workspace.threads.resize(n_threads);
+    for (int k = 0; k < n_threads; ++k)
+    {
+        Workspace::ThreadScratch &scratch = workspace.threads[k];
+        scratch.cost = 0;
+        scratch.G.resize(n_joints);
+        scratch.Q_partial.resize(n_joints + 1);
+        scratch.experiment.theta.resize(n_joints);
+        if (with_jacobian)
+        {
+            scratch.JtJ.setZero(n_unknowns, n_unknowns);
+            scratch.Jtr.setZero(n_unknowns);
+            scratch.J.resize(9, n_unknowns);
+        }
+    }
+    //
+    // The compact store is split between threads at its keyframes, from which decoding may start
+    const bool compact = data.empty();
+    const int n_items = compact ? (int) store.getNKeyframes() : (int) experiments.size();
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(n_threads)
+#endif
+    {
+#ifdef _OPENMP
+        Workspace::ThreadScratch &scratch = workspace.threads[omp_get_thread_num()];
+#else
+        Workspace::ThreadScratch &scratch = workspace.threads[0];
+#endif
+        const Eigen::Matrix<double, 9, Eigen::Dynamic> &J = scratch.J;
+        auto accumulate = [&] (const Experiment &experiment)
+        {
+            const unsigned int c = experiment.ind_order;
+            Eigen::Matrix3d E = this->_experimentResidual(experiment, axes, start_from_last, ind_joint_order, basis,
+                scratch, with_jacobian);
+            scratch.cost += E.squaredNorm();
+            if (!with_jacobian)
+                return;
+            //
+            const unsigned int width = 2 * (c + 1);
+            scratch.JtJ.topLeftCorner(width, width).noalias() += J.leftCols(width).transpose() * J.leftCols(width);
+            scratch.Jtr.head(width).noalias() += J.leftCols(width).transpose() * Eigen::Map<const Eigen::Matrix<double, 9, 1>>(E.data());
+        };
+        //
+#ifdef _OPENMP
+        #pragma omp for schedule(static)
+#endif
+        for (int ind_item = 0; ind_item < n_items; ++ind_item)
+        {
+            if (!compact)
+            {
+                accumulate(experiments[ind_item]);
+                continue;
+            }
+            const ExperimentStore::Record &record = scratch.decoder.getRecord();
+            scratch.decoder.reset(store, ind_item, ind_item + 1);
+            while (scratch.decoder.next())
+            {
+                if (workspace.skip_rejected && workspace.axes_weights[record.joint](record.ind_experiment) == 0)
+                    continue;
+                this->_setExperiment(scratch.experiment, workspace.ind_order[record.joint], record.delta_angle,
+                    record.theta, record.rpy_last, record.rpy_curr, start_from_last);
+                accumulate(scratch.experiment);
+            }
+        }
+    }
+    //
+    double cost = 0;
+    if (with_jacobian)
+    {
+        workspace.JtJ.setZero(n_unknowns, n_unknowns);
+        workspace.Jtr.setZero(n_unknowns);
+    }
+    for (int k = 0; k < n_threads; ++k)
+    {
+        cost += workspace.threads[k].cost;
+        if (with_jacobian)
+        {
+            workspace.JtJ += workspace.threads[k].JtJ;
+            workspace.Jtr += workspace.threads[k].Jtr;
+        }
+    }
+    return cost;
+}
+
+void Identification::_refineAxes(Workspace &workspace, bool start_from_last, unsigned int max_iterations, double tol,
+    bool skip_rejected) const
+{
+    Eigen::Matrix<double, 3, Eigen::Dynamic> &axes = workspace.axes;
+    bool valid = (axes.cols() == n_joints) && axes.allFinite();
+    for (unsigned int k = 0; valid && k < n_joints; ++k)
+        valid = axes.col(k).norm() > 0;
+    if (!valid)
+    {
+        std::cerr << "[Error] Invalid initial guess. Axes were not refined." << std::endl;
+        return;
+    }
+    for (unsigned int k = 0; k < n_joints; ++k)
+        axes.col(k).normalize();
+    //
+    this->_prepareExperiments(workspace, start_from_last, skip_rejected);
+    if (workspace.n_experiments == 0)
+        return;
+    //
+    const std::vector<unsigned int> &ind_joint_order = workspace.ind_joint_order;
+    const Eigen::MatrixXd &JtJ = workspace.JtJ;
+    const Eigen::VectorXd &Jtr = workspace.Jtr;
+    Eigen::MatrixXd &A = workspace.A;
+    Eigen::VectorXd &delta = workspace.delta;
+    Eigen::Matrix<double, 3, Eigen::Dynamic> &axes_candidate = workspace.axes_candidate;
+    axes_candidate.resize(3, n_joints);
+    double lambda = -1;
+    for (unsigned int iter = 0; iter < max_iterations; ++iter)
+    {
+        double cost = this->_accumulateNormalEquations(workspace, axes, start_from_last, true);
+        if (lambda < 0)
+            lambda = 1e-4 * JtJ.diagonal().maxCoeff();
+        //
+        bool accepted = false;
+        while (!accepted && lambda < 1e10 * (1 + JtJ.diagonal().maxCoeff()))
+        {
+            A = JtJ;
+            A.diagonal().array() += lambda * (JtJ.diagonal().array() + 1e-12);
+            workspace.ldlt.compute(A);
+            delta = -Jtr;
+            workspace.ldlt.solveInPlace(delta);
+            for (unsigned int k = 0; k < n_joints; ++k)
+            {
+                unsigned int ind_joint = ind_joint_order[k];
+                Eigen::Vector3d h = axes.col(ind_joint);
+                axes_candidate.col(ind_joint) = (h + HelperFunctions::tangentBasis<double>(h) * delta.segment<2>(2*k)).normalized();
+            }
+            double cost_candidate = this->_accumulateNormalEquations(workspace, axes_candidate, start_from_last, false);
+            if (cost_candidate < cost)
+            {
+                axes = axes_candidate;
+                lambda /= 10;
+                accepted = true;
+            }
+            else
+                lambda *= 10;
+        }
+        if (!accepted || delta.norm() < tol)
+            break;
+    }
+}
+
+Eigen::Matrix<double, 3, Eigen::Dynamic> Identification::refineAxes(const Eigen::Matrix<double, 3, Eigen::Dynamic> &axes_initial,
+    bool start_from_last, unsigned int max_iterations, double tol) const
+{
+    Workspace workspace;
+    workspace.axes = axes_initial;
+    this->_refineAxes(workspace, start_from_last, max_iterations, tol);
+    return workspace.axes;
+}
+
+double Identification::computeResidual(const Eigen::Matrix<double, 3, Eigen::Dynamic> &axes, bool start_from_last) const
+{
+    Workspace workspace;
+    this->_prepareExperiments(workspace, start_from_last);
+    if (workspace.n_experiments == 0)
+        return 0;
+    double cost = this->_accumulateNormalEquations(workspace, axes, start_from_last, false);
+    return std::sqrt(cost / workspace.n_experiments);
+}
+
+double Identification::computeInformation(Workspace &workspace, const Eigen::Matrix<double, 3, Eigen::Dynamic> &axes,
+    Eigen::MatrixXd &information, bool start_from_last) const
+{
+    information.setZero(2 * n_joints, 2 * n_joints);
+    this->_prepareExperiments(workspace, start_from_last);
+    if (workspace.n_experiments == 0)
+        return 0;
+    double cost = this->_accumulateNormalEquations(workspace, axes, start_from_last, true);
+    // From the order in which joints are chained to the joint index
+    const std::vector<unsigned int> &ind_joint_order = workspace.ind_joint_order;
+    for (unsigned int a = 0; a < n_joints; ++a)
+        for (unsigned int b = 0; b < n_joints; ++b)
+            information.block<2,2>(2 * ind_joint_order[a], 2 * ind_joint_order[b]) = workspace.JtJ.block<2,2>(2 * a, 2 * b);
+    return cost;
+}
+
+void Identification::computeExperimentJacobian(Workspace &workspace, const Eigen::Matrix<double, 3, Eigen::Dynamic> &axes,
+    const Eigen::VectorXd &theta, unsigned int joint, double delta_angle,
+    Eigen::Matrix<double, 9, Eigen::Dynamic> &J, bool start_from_last) const
+{
+    std::vector<unsigned int> &ind_joint_order = workspace.ind_joint_order;
+    this->_jointOrder(ind_joint_order, start_from_last);
+    std::vector<Eigen::Matrix<double, 3, 2>> &basis = workspace.basis;
+    basis.resize(n_joints);
+    for (unsigned int k = 0; k < n_joints; ++k)
+        basis[k] = HelperFunctions::tangentBasis<double>(axes.col(ind_joint_order[k]));
+    if (workspace.threads.empty())
+        workspace.threads.resize(1);
+    Workspace::ThreadScratch &scratch = workspace.threads[0];
+    scratch.G.resize(n_joints);
+    scratch.Q_partial.resize(n_joints + 1);
+    scratch.J.setZero(9, 2 * n_joints);
+    //
+    Experiment experiment;
+    experiment.ind_order = std::find(ind_joint_order.begin(), ind_joint_order.end(), joint) - ind_joint_order.begin();
+    experiment.delta_angle = delta_angle;
+    experiment.theta = theta;
+    // Measurement predicted by the current axes, see _experimentResidual
+    experiment.R.setIdentity();
+    this->_experimentResidual(experiment, axes, start_from_last, ind_joint_order, basis, scratch, false);
+    const Eigen::Matrix3d &Q = scratch.Q_partial[experiment.ind_order];
+    experiment.R = Q.transpose() * HelperFunctions::rotAngleAxis<double>(delta_angle, axes.col(joint)) * Q;
+    this->_experimentResidual(experiment, axes, start_from_last, ind_joint_order, basis, scratch, true);
+    //
+    J.setZero(9, 2 * n_joints);
+    for (unsigned int c = 0; c <= experiment.ind_order; ++c)
+        J.middleCols<2>(2 * ind_joint_order[c]) = scratch.J.middleCols<2>(2 * c);
+}
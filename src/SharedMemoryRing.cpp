@@ -0,0 +1,176 @@
+#include "SharedMemoryRing.hpp"
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace axes_ident;
+
+SharedMemoryRing::SharedMemoryRing() :
+    fd(-1), memory(nullptr), size(0), owner(false),
+    header(nullptr), slots(nullptr), slot_size(0), n_joints(0), capacity(0), n_values(0)
+{
+}
+
+SharedMemoryRing::~SharedMemoryRing()
+{
+    this->close();
+}
+
+bool SharedMemoryRing::_map(int prot)
+{
+    memory = mmap(nullptr, size, prot, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED)
+    {
+        memory = nullptr;
+        std::cerr << "[Error] Failed to map shared memory " << name << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    header = static_cast<Header *>(memory);
+    slots = static_cast<unsigned char *>(memory) + _headerSize();
+    return true;
+}
+
+bool SharedMemoryRing::create(const std::string &name, unsigned int n_joints, unsigned int capacity)
+{
+    this->close();
+    if (capacity == 0)
+    {
+        std::cerr << "[Error] Shared memory ring capacity should be positive." << std::endl;
+        return false;
+    }
+    this->name = name;
+    // Consumers may still map a ring left by a previous producer, so it is unlinked rather than truncated
+    shm_unlink(name.c_str());
+    fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        std::cerr << "[Error] Failed to create shared memory " << name << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    owner = true;
+    this->n_joints = n_joints;
+    this->capacity = capacity;
+    n_values = n_joints + 3;
+    slot_size = sizeof(std::uint64_t) + n_values * sizeof(double);
+    size = _headerSize() + capacity * slot_size;
+    if (ftruncate(fd, size) != 0 || !this->_map(PROT_READ | PROT_WRITE))
+    {
+        std::cerr << "[Error] Failed to allocate shared memory " << name << '.' << std::endl;
+        this->close();
+        return false;
+    }
+    if (!header->write_sequence.is_lock_free())
+        std::clog << "[Warn] Atomic sequence numbers are not lock-free, consumers in other processes may fail." << std::endl;
+
+    for (unsigned int k = 0; k < capacity; ++k)
+        new (slots + k * slot_size) std::atomic<std::uint64_t>(SEQUENCE_BUSY);
+    new (&header->write_sequence) std::atomic<std::uint64_t>(0);
+    header->n_joints = n_joints;
+    header->capacity = capacity;
+    header->version = VERSION;
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = MAGIC;
+    return true;
+}
+
+bool SharedMemoryRing::open(const std::string &name)
+{
+    this->close();
+    this->name = name;
+    fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+        std::cerr << "[Error] Failed to open shared memory " << name << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (std::size_t) info.st_size < _headerSize())
+    {
+        std::cerr << "[Error] Shared memory " << name << " is too small to hold a ring." << std::endl;
+        this->close();
+        return false;
+    }
+    size = info.st_size;
+    if (!this->_map(PROT_READ))
+    {
+        this->close();
+        return false;
+    }
+    n_joints = header->n_joints;
+    capacity = header->capacity;
+    n_values = n_joints + 3;
+    slot_size = sizeof(std::uint64_t) + n_values * sizeof(double);
+    if (!this->hasValidHeader() || capacity == 0 || size != _headerSize() + capacity * slot_size)
+    {
+        std::cerr << "[Error] Shared memory " << name << " does not hold a valid ring." << std::endl;
+        this->close();
+        return false;
+    }
+    return true;
+}
+
+void SharedMemoryRing::close()
+{
+    bool remove = owner && !this->isReplaced();
+    if (owner && header != nullptr)
+        header->magic = 0;
+    if (memory != nullptr)
+        munmap(memory, size);
+    if (fd >= 0)
+        ::close(fd);
+    // A producer that took over the name keeps its ring
+    if (remove)
+        shm_unlink(name.c_str());
+    fd = -1;
+    memory = nullptr;
+    size = 0;
+    owner = false;
+    header = nullptr;
+    slots = nullptr;
+}
+
+bool SharedMemoryRing::hasValidHeader() const
+{
+    return header->magic == MAGIC && header->version == VERSION &&
+        header->n_joints == n_joints && header->capacity == capacity;
+}
+
+bool SharedMemoryRing::isReplaced() const
+{
+    int fd_name = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd_name < 0)
+        return true;
+    struct stat info_name, info;
+    bool replaced = fstat(fd_name, &info_name) != 0 || fstat(fd, &info) != 0 ||
+        info_name.st_dev != info.st_dev || info_name.st_ino != info.st_ino;
+    ::close(fd_name);
+    return replaced;
+}
+
+void SharedMemoryRing::publish(const double *values)
+{
+    std::uint64_t sequence = header->write_sequence.load(std::memory_order_relaxed);
+    std::atomic<std::uint64_t> &slot_sequence = this->_slotSequence(sequence);
+    // Readers that see the slot busy, or whose sequence changed while reading, discard it
+    slot_sequence.store(SEQUENCE_BUSY, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(this->_slotValues(sequence), values, n_values * sizeof(double));
+    slot_sequence.store(sequence, std::memory_order_release);
+    header->write_sequence.store(sequence + 1, std::memory_order_release);
+}
+
+bool SharedMemoryRing::read(std::uint64_t sequence, double *values) const
+{
+    const std::atomic<std::uint64_t> &slot_sequence = this->_slotSequence(sequence);
+    if (slot_sequence.load(std::memory_order_acquire) != sequence)
+        return false;
+    std::memcpy(values, this->_slotValues(sequence), n_values * sizeof(double));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot_sequence.load(std::memory_order_relaxed) == sequence;
+}
@@ -0,0 +1,137 @@
+// Compares memory use and decoding throughput of the dense and compact experiment storage.
+#include <Identification.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+using namespace axes_ident;
+
+void usage(const char *program)
+{
+    std::cerr << "Usage: " << program << " [options] <data file>" << std::endl <<
+        "  -d <delimiter>  delimiter of the data file, 'tab' for tabs (default: space)" << std::endl <<
+        "  -f <columns>    comma separated columns to filter out of the data file" << std::endl <<
+        "  -q <tolerance>  quantization tolerance of the compact storage (default: 0, exact)" << std::endl <<
+        "  -k <interval>   records between keyframes of the compact storage" << std::endl <<
+        "  -r <count>      times the recording is repeated to emulate longer ones (default: 100)" << std::endl;
+}
+
+template <typename Function>
+double secondsPerCall(unsigned int n_calls, Function function)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int k = 0; k < n_calls; ++k)
+        function();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / n_calls;
+}
+
+int main(int argc, char **argv)
+{
+    DataParser parser_file, parser_dense, parser_compact;
+    double tol_quantization = 0;
+    unsigned int keyframe_interval = ExperimentStore::DEFAULT_KEYFRAME_INTERVAL, repetitions = 100;
+    int option;
+    while ((option = getopt(argc, argv, "d:f:q:k:r:")) != -1)
+    {
+        switch (option)
+        {
+        case 'd':
+            parser_file.setDelimiter(std::string(optarg) == "tab" ? '\t' : optarg[0]);
+            break;
+        case 'f':
+        {
+            std::vector<unsigned int> filter;
+            std::stringstream stream(optarg);
+            std::string column;
+            while (std::getline(stream, column, ','))
+                filter.push_back(std::atoi(column.c_str()));
+            parser_file.setFilter(filter);
+            break;
+        }
+        case 'q':
+            tol_quantization = std::atof(optarg);
+            break;
+        case 'k':
+            keyframe_interval = std::atoi(optarg);
+            break;
+        case 'r':
+            repetitions = std::atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    parser_file.setStorageMask(DataParser::Storage::SINGLE);
+    if (!parser_file.readFile(argv[optind]))
+        return 1;
+    Eigen::Ref<const DataParser::Data> rows = parser_file.getData();
+    unsigned int n_joints = parser_file.getNJoints();
+    DataParser::Data recording(rows.rows() * repetitions, n_joints + 3);
+    for (unsigned int k = 0; k < repetitions; ++k)
+        recording.middleRows(k * rows.rows(), rows.rows()) = rows.leftCols(n_joints + 3);
+
+    parser_compact.setStorageMask(DataParser::Storage::COMPACT);
+    parser_compact.setCompactStorage(tol_quantization, keyframe_interval);
+    if (!parser_dense.readData(recording) || !parser_compact.readData(recording))
+        return 1;
+
+    std::size_t bytes_dense = parser_dense.getData().size() * sizeof(double);
+    for (const Eigen::Ref<const DataParser::Data> &experiments : parser_dense.getDataByJoint())
+        bytes_dense += experiments.size() * sizeof(double);
+    const ExperimentStore &store = parser_compact.getExperimentStore();
+    std::size_t bytes_compact = store.getMemoryUsage();
+    std::cout << store.getNRecords() << " experiments of " << n_joints << " joints" << std::endl;
+    std::cout << "Memory: dense " << bytes_dense << " bytes, compact " << bytes_compact << " bytes (" <<
+        (double) bytes_dense / bytes_compact << "x smaller)" << std::endl;
+
+    // Touch every value an identification reads
+    volatile double sink = 0;
+    unsigned int n_calls = 20;
+    double time_dense = secondsPerCall(n_calls, [&]()
+    {
+        double sum = 0;
+        for (const Eigen::Ref<const DataParser::Data> &experiments : parser_dense.getDataByJoint())
+        {
+            for (unsigned int k = 0; k + 1 < experiments.rows(); k += 2)
+                sum += experiments.row(k).sum() + experiments.row(k + 1).sum();
+        }
+        sink = sum;
+    });
+    ExperimentStore::Decoder decoder;
+    double time_compact = secondsPerCall(n_calls, [&]()
+    {
+        double sum = 0;
+        decoder.reset(store);
+        const ExperimentStore::Record &record = decoder.getRecord();
+        while (decoder.next())
+            sum += record.theta.sum() + record.delta_angle + record.rpy_last.sum() + record.rpy_curr.sum();
+        sink = sum;
+    });
+    std::cout << "Decoding: dense " << store.getNRecords() / time_dense << " experiments/s, compact " <<
+        store.getNRecords() / time_compact << " experiments/s" << std::endl;
+
+    Identification ident_dense(n_joints), ident_compact(n_joints);
+    ident_dense.setData(parser_dense);
+    ident_compact.setData(parser_compact);
+    Identification::Workspace workspace;
+    n_calls = 3;
+    time_dense = secondsPerCall(n_calls, [&]() { ident_dense.identifyAxes(workspace); });
+    time_compact = secondsPerCall(n_calls, [&]() { ident_compact.identifyAxes(workspace); });
+    std::cout << "identifyAxes: dense " << time_dense << " s, compact " << time_compact << " s" << std::endl;
+    // The refinement decodes the compact store once per evaluation of the cost
+    time_dense = secondsPerCall(n_calls, [&]() { ident_dense.identifyAxes(workspace, false, true); });
+    time_compact = secondsPerCall(n_calls, [&]() { ident_compact.identifyAxes(workspace, false, true); });
+    std::cout << "identifyAxes with refinement: dense " << time_dense << " s, compact " << time_compact << " s" << std::endl;
+    return 0;
+}
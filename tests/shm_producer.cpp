@@ -0,0 +1,95 @@
+// Stand-in for the acquisition process: publishes the rows of a data file to a shared memory ring.
+#include <DataParser.hpp>
+#include <SharedMemoryRing.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+using namespace axes_ident;
+
+void usage(const char *program)
+{
+    std::cerr << "Usage: " << program << " [options] <shared memory name> <data file>" << std::endl <<
+        "  -d <delimiter>  delimiter of the data file, 'tab' for tabs (default: space)" << std::endl <<
+        "  -f <columns>    comma separated columns to filter out of the data file" << std::endl <<
+        "  -c <capacity>   number of samples kept in the ring (default: 1024)" << std::endl <<
+        "  -p <period>     microseconds between samples (default: 0)" << std::endl <<
+        "  -r <count>      times the file is published, for benchmarks (default: 1)" << std::endl <<
+        "  -w <time>       milliseconds to wait before removing the ring (default: 0)" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    DataParser parser;
+    unsigned int capacity = 1024, period = 0, repetitions = 1, wait = 0;
+    int option;
+    while ((option = getopt(argc, argv, "d:f:c:p:r:w:")) != -1)
+    {
+        switch (option)
+        {
+        case 'd':
+            parser.setDelimiter(std::string(optarg) == "tab" ? '\t' : optarg[0]);
+            break;
+        case 'f':
+        {
+            std::vector<unsigned int> filter;
+            std::stringstream stream(optarg);
+            std::string column;
+            while (std::getline(stream, column, ','))
+                filter.push_back(std::atoi(column.c_str()));
+            parser.setFilter(filter);
+            break;
+        }
+        case 'c':
+            capacity = std::atoi(optarg);
+            break;
+        case 'p':
+            period = std::atoi(optarg);
+            break;
+        case 'r':
+            repetitions = std::atoi(optarg);
+            break;
+        case 'w':
+            wait = std::atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 2)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    parser.setStorageMask(DataParser::Storage::SINGLE);
+    if (!parser.readFile(argv[optind + 1]))
+        return 1;
+    Eigen::Ref<const DataParser::Data> data = parser.getData();
+
+    SharedMemoryRing ring;
+    if (!ring.create(argv[optind], parser.getNJoints(), capacity))
+        return 1;
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int repetition = 0; repetition < repetitions; ++repetition)
+    {
+        for (unsigned int k = 0; k < data.rows(); ++k)
+        {
+            ring.publish(data.row(k).data());
+            if (period > 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(period));
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Published " << ring.getWriteSequence() << " samples in " << elapsed.count() << " s (" <<
+        ring.getWriteSequence() / elapsed.count() << " samples/s)" << std::endl;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait));
+    return 0;
+}
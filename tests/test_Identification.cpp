@@ -2,6 +2,36 @@
 #include <boost/test/unit_test.hpp>
 
 #include <Identification.hpp>
+#include <ExcitationPlanner.hpp>
+#include <SharedMemoryRing.hpp>
+#include <random>
+#include <numeric>
+#include <thread>
+#include <chrono>
+#ifdef AXES_IDENT_SHARED_MEMORY
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#ifdef __GLIBC__
+// Counts the heap allocations of each thread, including the ones made by Eigen
+extern "C" void *__libc_malloc(std::size_t size);
+extern "C" void *__libc_realloc(void *ptr, std::size_t size);
+static thread_local unsigned long n_allocations = 0;
+extern "C" void *malloc(std::size_t size)
+{
+    ++n_allocations;
+    return __libc_malloc(size);
+}
+extern "C" void *realloc(void *ptr, std::size_t size)
+{
+    ++n_allocations;
+    return __libc_realloc(ptr, size);
+}
+#endif
 
 using namespace axes_ident;
 
@@ -80,4 +110,726 @@ BOOST_AUTO_TEST_CASE( identification_test )
                       -0.638841, 0.146594, 0.281562, 0.860227,  0.682784;
     //
     testFile("../tests/random_data.txt", parser, matlab_answer_1, matlab_answer_2, 5e-2);
-}
\ No newline at end of file
+}
+BOOST_AUTO_TEST_CASE( refinement_test )
+{
+    DataParser parser;
+    parser.setDelimiter('\t');
+    BOOST_REQUIRE_MESSAGE(parser.readFile("../tests/random_data.txt"),
+        "File ../tests/random_data.txt not found... Some tests might have been skipped!"
+    );
+    const DataParser::Data data = parser.getData().leftCols(parser.getNJoints() + 3);
+
+    Identification ident(parser.getNJoints());
+    ident.setData(parser);
+    auto axis_1 = ident.identifyAxes(false);
+    auto axis_2 = ident.identifyAxes(true);
+    auto axis_refined_1 = ident.identifyAxes(false, true);
+    auto axis_refined_2 = ident.identifyAxes(true, true);
+
+    BOOST_CHECK_MESSAGE(ident.computeResidual(axis_refined_1, false) < ident.computeResidual(axis_1, false),
+        "Refinement starting from the right did not reduce the residual!");
+    BOOST_CHECK_MESSAGE(ident.computeResidual(axis_refined_2, true) < ident.computeResidual(axis_2, true),
+        "Refinement starting from the left did not reduce the residual!");
+
+    BOOST_CHECK_MESSAGE(compareMatrices(axis_refined_1, axis_1, 5e-2) && compareMatrices(axis_refined_2, axis_2, 5e-2),
+        "Refined axes are too far from the greedy identification!");
+
+    double diff_greedy = (axis_1 - axis_2).norm();
+    double diff_refined = (axis_refined_1 - axis_refined_2).norm();
+    BOOST_CHECK_MESSAGE(diff_refined < diff_greedy / 2,
+        "Refined identifications starting from the right and from the left should agree better than the greedy ones!");
+
+    // Shorter calibration run: only the first experiments of each joint
+    const unsigned int n_rows_joint = data.rows() / parser.getNJoints();
+    const unsigned int n_rows_short = 10;
+    DataParser::Data data_short(n_rows_short * parser.getNJoints(), data.cols());
+    for (unsigned int k = 0; k < parser.getNJoints(); ++k)
+        data_short.middleRows(k * n_rows_short, n_rows_short) = data.middleRows(k * n_rows_joint, n_rows_short);
+
+    DataParser parser_short;
+    BOOST_REQUIRE(parser_short.readData(data_short));
+    Identification ident_short(parser_short.getNJoints());
+    ident_short.setData(parser_short);
+    auto axis_short = ident_short.identifyAxes(false);
+    auto axis_short_refined = ident_short.identifyAxes(false, true);
+
+    // Compare against the full run chained from the other side, so that neither estimate shares its bias
+    BOOST_CHECK_MESSAGE((axis_short_refined - axis_refined_2).norm() < (axis_short - axis_refined_2).norm(),
+        "Refinement did not improve the identification from a short calibration run!");
+    BOOST_CHECK_MESSAGE((axis_short_refined - axis_refined_2).norm() < (axis_1 - axis_refined_2).norm(),
+        "Refinement of a short run should beat the greedy identification of the full run!");
+}
+
+void writeFile(const std::string &file, const std::string &contents)
+{
+    std::ofstream stream(file, std::ios_base::binary | std::ios_base::trunc);
+    stream << contents;
+}
+
+bool sameData(const DataParser &parser_1, const DataParser &parser_2)
+{
+    if (parser_1.getNJoints() != parser_2.getNJoints() || parser_1.getData() != parser_2.getData())
+        return false;
+    for (unsigned int k = 0; k < parser_1.getNJoints(); ++k)
+    {
+        if (parser_1.getDataByJoint()[k] != parser_2.getDataByJoint()[k])
+            return false;
+    }
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE( follow_test )
+{
+    const std::string file_follow = "follow_test.txt";
+    std::ifstream stream("../tests/panda.txt", std::ios_base::binary);
+    BOOST_REQUIRE_MESSAGE(stream.is_open(), "File ../tests/panda.txt not found... Some tests might have been skipped!");
+    const std::string contents((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+
+    DataParser parser_follow, parser_full;
+    for (DataParser *parser : {&parser_follow, &parser_full})
+    {
+        parser->setFilter( {3,4,5} );
+        parser->setDelimiter('\t');
+    }
+
+    // The file grows in chunks that end in the middle of a line
+    Identification ident(3);
+    bool ident_configured = false;
+    for (std::size_t size : {contents.size() / 7, contents.size() / 3 + 5, 2 * contents.size() / 3 + 11, contents.size()})
+    {
+        writeFile(file_follow, contents.substr(0, size));
+        bool ok = parser_follow.followFile(file_follow);
+        std::size_t size_complete = contents.rfind('\n', size - 1) + 1;
+        writeFile(file_follow, contents.substr(0, size_complete));
+        parser_full.readFile(file_follow);
+        BOOST_CHECK_EQUAL(ok, parser_full.check());
+        if (parser_full.check())
+        {
+            BOOST_CHECK_MESSAGE(sameData(parser_follow, parser_full), "Followed and fully read data differ!");
+            ident_configured = ident_configured ? ident.updateData(parser_follow) : ident.setData(parser_follow);
+            BOOST_CHECK(ident_configured);
+        }
+    }
+    BOOST_REQUIRE(ident_configured);
+
+    Identification ident_full(3);
+    ident_full.setData(parser_full);
+    BOOST_CHECK_MESSAGE(compareMatrices(ident.identifyAxes(), ident_full.identifyAxes(), 1e-12),
+        "Incrementally updated identification differs from the one with all data!");
+
+    // Parsing stops at the first empty line, as in readFile, even if more lines are appended later
+    DataParser parser_blank;
+    parser_blank.setFilter( {3,4,5} );
+    parser_blank.setDelimiter('\t');
+    std::size_t size_blank = contents.rfind('\n', 9 * contents.size() / 10) + 1;
+    const std::string contents_blank = contents.substr(0, size_blank) + "\n" + contents.substr(size_blank);
+    writeFile(file_follow, contents_blank.substr(0, size_blank + 1));
+    parser_blank.followFile(file_follow);
+    writeFile(file_follow, contents_blank);
+    BOOST_CHECK_EQUAL(parser_blank.followFile(file_follow), parser_full.readFile(file_follow));
+    BOOST_CHECK(parser_full.check());
+    BOOST_CHECK_MESSAGE(sameData(parser_blank, parser_full), "Followed file was parsed past an empty line!");
+    BOOST_CHECK_EQUAL(parser_full.getData().rows(), std::count(contents.begin(), contents.begin() + size_blank, '\n'));
+
+    // Lines ending in CRLF, the empty one included, are parsed the same way
+    DataParser parser_crlf;
+    parser_crlf.setFilter( {3,4,5} );
+    parser_crlf.setDelimiter('\t');
+    std::string contents_crlf;
+    for (char c : contents_blank)
+        contents_crlf += (c == '\n') ? std::string("\r\n") : std::string(1, c);
+    writeFile(file_follow, contents_crlf);
+    BOOST_CHECK(parser_crlf.followFile(file_follow));
+    BOOST_CHECK_MESSAGE(sameData(parser_crlf, parser_full), "Followed CRLF file was parsed past an empty line!");
+    DataParser parser_empty;
+    parser_empty.setFilter( {3,4,5} );
+    parser_empty.setDelimiter('\t');
+    writeFile(file_follow, "\r\n" + contents);
+    BOOST_CHECK(!parser_empty.followFile(file_follow));
+    BOOST_CHECK_EQUAL(parser_empty.getData().rows(), 0);
+
+    // Truncated file is read from the start
+    writeFile(file_follow, contents.substr(0, contents.rfind('\n', contents.size() / 2) + 1));
+    BOOST_CHECK(!parser_follow.followFile(file_follow));
+    BOOST_CHECK(!parser_full.readFile(file_follow));
+    BOOST_CHECK_EQUAL(parser_follow.getData().rows(), std::count(contents.begin(), contents.begin() + contents.size() / 2, '\n'));
+
+    // Replaced file is read from the start
+    std::ifstream stream_other("../tests/parrot.txt", std::ios_base::binary);
+    const std::string contents_other((std::istreambuf_iterator<char>(stream_other)), std::istreambuf_iterator<char>());
+    writeFile(file_follow, contents_other);
+    BOOST_CHECK(parser_follow.followFile(file_follow));
+    BOOST_CHECK(parser_full.readFile(file_follow));
+    BOOST_CHECK_MESSAGE(sameData(parser_follow, parser_full), "Replaced file was not read from the start!");
+    BOOST_CHECK(ident.updateData(parser_follow));
+
+    std::remove(file_follow.c_str());
+}
+
+#ifdef AXES_IDENT_SHARED_MEMORY
+BOOST_AUTO_TEST_CASE( shared_memory_test )
+{
+    const std::string name = "/axes_ident_test";
+    DataParser parser_ring, parser_full;
+    parser_full.setFilter( {3,4,5} );
+    parser_full.setDelimiter('\t');
+    BOOST_REQUIRE_MESSAGE(parser_full.readFile("../tests/panda.txt"),
+        "File ../tests/panda.txt not found... Some tests might have been skipped!");
+    Eigen::Ref<const DataParser::Data> rows = parser_full.getData();
+    const unsigned int capacity = 64;
+
+    SharedMemoryRing ring;
+    BOOST_REQUIRE(ring.create(name, parser_full.getNJoints(), capacity));
+    BOOST_REQUIRE(parser_ring.openSharedMemory(name));
+
+    // Batches smaller than the ring are read without losses
+    for (unsigned int k = 0; k < rows.rows(); ++k)
+    {
+        ring.publish(rows.row(k).data());
+        if (k % 20 == 19)
+            parser_ring.readSharedMemory();
+    }
+    BOOST_CHECK(parser_ring.readSharedMemory());
+    BOOST_CHECK_EQUAL(parser_ring.getNLostSamples(), 0);
+    BOOST_CHECK_MESSAGE(sameData(parser_ring, parser_full), "Data read from shared memory and from the file differ!");
+
+    // Samples overwritten before being read are counted
+    for (unsigned int k = 0; k < rows.rows(); ++k)
+        ring.publish(rows.row(k).data());
+    BOOST_CHECK(parser_ring.readSharedMemory());
+    BOOST_CHECK_EQUAL(parser_ring.getNLostSamples(), rows.rows() - capacity);
+    BOOST_CHECK_EQUAL(parser_ring.getData().rows(), rows.rows() + capacity);
+    BOOST_CHECK(parser_ring.getData().bottomRows(capacity).leftCols(6) == rows.bottomRows(capacity).leftCols(6));
+
+#ifdef __GLIBC__
+    // Samples are consumed in place and the storage grows geometrically, so most polls do not allocate memory
+    DataParser parser_poll;
+    parser_poll.setStorageMask(DataParser::Storage::SINGLE | DataParser::Storage::MULTIPLE | DataParser::Storage::COMPACT);
+    BOOST_REQUIRE(parser_poll.openSharedMemory(name));
+    parser_poll.readSharedMemory();
+    const unsigned long n_lost_samples = parser_poll.getNLostSamples();
+    unsigned int n_polls = 0;
+    unsigned long n_allocations_before = n_allocations;
+    for (unsigned int repetition = 0; repetition < 8; ++repetition)
+    {
+        for (unsigned int k = 0; k < rows.rows(); ++k)
+        {
+            ring.publish(rows.row(k).data());
+            if (k % 5 == 4)
+            {
+                parser_poll.readSharedMemory();
+                ++n_polls;
+            }
+        }
+    }
+    unsigned long n_poll_allocations = n_allocations - n_allocations_before;
+    BOOST_CHECK_EQUAL(parser_poll.getNLostSamples(), n_lost_samples);
+    BOOST_CHECK_MESSAGE(n_poll_allocations < n_polls / 4,
+        "Reading shared memory allocated memory " << n_poll_allocations << " times in " << n_polls << " polls!");
+#endif
+
+    // Consumers never see torn samples while the producer writes concurrently
+    const unsigned long n_samples = 200000;
+    std::thread producer([&ring, n_samples]()
+    {
+        double values[6];
+        for (unsigned long k = 0; k < n_samples; ++k)
+        {
+            std::fill(values, values + 6, (double) k);
+            ring.publish(values);
+        }
+    });
+    SharedMemoryRing ring_consumer;
+    BOOST_REQUIRE(ring_consumer.open(name));
+    unsigned long n_read = 0, n_torn = 0;
+    std::uint64_t sequence = ring_consumer.getWriteSequence();
+    const std::uint64_t sequence_end = sequence + n_samples;
+    double values[6];
+    while (sequence < sequence_end)
+    {
+        std::uint64_t write_sequence = ring_consumer.getWriteSequence();
+        sequence = std::max(sequence, (write_sequence > capacity) ? write_sequence - capacity : 0);
+        for (; sequence < write_sequence; ++sequence)
+        {
+            if (ring_consumer.read(sequence, values))
+            {
+                ++n_read;
+                n_torn += std::count(values, values + 6, values[0]) != 6;
+            }
+        }
+    }
+    producer.join();
+    BOOST_CHECK_GT(n_read, 0);
+    BOOST_CHECK_EQUAL(n_torn, 0);
+
+    // A producer that restarts with a larger ring replaces it, and the consumer opens the new one
+    parser_ring.readSharedMemory();
+    SharedMemoryRing ring_restarted;
+    BOOST_REQUIRE(ring_restarted.create(name, parser_full.getNJoints(), 4 * capacity));
+    for (unsigned int k = 0; k < rows.rows(); ++k)
+        ring_restarted.publish(rows.row(k).data());
+    BOOST_CHECK(ring.isReplaced());
+    BOOST_CHECK(parser_ring.readSharedMemory());
+    BOOST_CHECK_EQUAL(parser_ring.getNLostSamples(), 0);
+    BOOST_CHECK_MESSAGE(sameData(parser_ring, parser_full), "Data read from the restarted ring and from the file differ!");
+    // A producer that shuts down marks its ring invalid before removing it
+    ring_restarted.close();
+    BOOST_CHECK(!parser_ring.readSharedMemory());
+
+    // The producer process is consumed across processes, as the acquisition process would be
+    const std::string name_producer = "/axes_ident_test_producer";
+    shm_unlink(name_producer.c_str());
+    std::vector<std::string> arguments = {"./shm-producer", "-d", "tab", "-f", "3,4,5", "-c", "256", "-p", "200",
+        "-w", "1000", name_producer, "../tests/panda.txt"};
+    std::vector<char *> argv;
+    for (std::string &argument : arguments)
+        argv.push_back(&argument[0]);
+    argv.push_back(nullptr);
+    pid_t pid;
+    BOOST_REQUIRE_MESSAGE(posix_spawn(&pid, argv[0], nullptr, nullptr, argv.data(), environ) == 0,
+        "Failed to start ./shm-producer");
+    // Wait until the ring exists, so opening it does not fail
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&start] () { return std::chrono::steady_clock::now() - start; };
+    int fd = -1;
+    while (fd < 0 && elapsed() < std::chrono::seconds(5))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        fd = shm_open(name_producer.c_str(), O_RDONLY, 0);
+    }
+    BOOST_REQUIRE(fd >= 0);
+    close(fd);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    DataParser parser_process;
+    BOOST_REQUIRE(parser_process.openSharedMemory(name_producer));
+    while (parser_process.getData().rows() + parser_process.getNLostSamples() < (unsigned int) rows.rows() &&
+        elapsed() < std::chrono::seconds(5))
+    {
+        parser_process.readSharedMemory();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    BOOST_CHECK_EQUAL(parser_process.getNLostSamples(), 0);
+    BOOST_CHECK_MESSAGE(sameData(parser_process, parser_full), "Data read from another process and from the file differ!");
+    parser_process.closeSharedMemory();
+    int status;
+    BOOST_CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+#endif
+
+/**
+ * @brief Largest difference between the decoded records and the experiments of a parser with dense storage.
+ */
+double compareRecords(const ExperimentStore &store, const DataParser &parser, unsigned int ind_keyframe = 0,
+    unsigned int ind_record_first = 0)
+{
+    const std::vector<Eigen::Ref<const DataParser::Data>> data_by_joint = parser.getDataByJoint();
+    unsigned int n_joints = parser.getNJoints();
+    // Records are in recording order, the experiments of each joint in the same relative order
+    std::vector<unsigned int> ind_exp(n_joints, 0);
+    ExperimentStore::Decoder decoder_skip;
+    decoder_skip.reset(store);
+    for (unsigned int k = 0; k < ind_record_first && decoder_skip.next(); ++k)
+        ++ind_exp[decoder_skip.getRecord().joint];
+
+    ExperimentStore::Decoder decoder;
+    decoder.reset(store, ind_keyframe);
+    const ExperimentStore::Record &record = decoder.getRecord();
+    double error = 0;
+    unsigned int n_records = ind_record_first;
+    while (decoder.next())
+    {
+        ++n_records;
+        if (record.joint >= n_joints || 2 * ind_exp[record.joint] + 1 >= data_by_joint[record.joint].rows())
+            return INFINITY;
+        auto row_last = data_by_joint[record.joint].row(2 * ind_exp[record.joint]);
+        auto row_curr = data_by_joint[record.joint].row(2 * ind_exp[record.joint] + 1);
+        ++ind_exp[record.joint];
+        error = std::max(error, (record.theta.transpose() - row_curr.head(n_joints)).cwiseAbs().maxCoeff());
+        error = std::max(error, std::abs(record.delta_angle - (row_curr(record.joint) - row_last(record.joint))));
+        error = std::max(error, (record.rpy_last.transpose() - row_last.segment<3>(n_joints)).cwiseAbs().maxCoeff());
+        error = std::max(error, (record.rpy_curr.transpose() - row_curr.segment<3>(n_joints)).cwiseAbs().maxCoeff());
+    }
+    return (n_records == store.getNRecords()) ? error : INFINITY;
+}
+
+BOOST_AUTO_TEST_CASE( compact_store_test )
+{
+    DataParser parser_dense, parser_compact, parser_quantized;
+    for (DataParser *parser : {&parser_dense, &parser_compact, &parser_quantized})
+    {
+        parser->setFilter( {3,4,5} );
+        parser->setDelimiter('\t');
+    }
+    const double tol_quantization = 1e-5;
+    const unsigned int keyframe_interval = 16;
+    parser_compact.setStorageMask(DataParser::Storage::COMPACT);
+    parser_compact.setCompactStorage(0, keyframe_interval);
+    parser_quantized.setStorageMask(DataParser::Storage::COMPACT);
+    parser_quantized.setCompactStorage(tol_quantization, keyframe_interval);
+    BOOST_REQUIRE_MESSAGE(parser_dense.readFile("../tests/panda.txt"),
+        "File ../tests/panda.txt not found... Some tests might have been skipped!");
+    BOOST_REQUIRE(parser_compact.readFile("../tests/panda.txt"));
+    BOOST_REQUIRE(parser_quantized.readFile("../tests/panda.txt"));
+    BOOST_CHECK(parser_compact.getDataByJoint().empty());
+
+    // Records decode to the dense experiments, exactly or within the quantization tolerance
+    const ExperimentStore &store = parser_compact.getExperimentStore();
+    const ExperimentStore &store_quantized = parser_quantized.getExperimentStore();
+    for (unsigned int k = 0; k < parser_dense.getNJoints(); ++k)
+        BOOST_CHECK_EQUAL(2 * store.getNExperiments(k), parser_dense.getDataByJoint()[k].rows());
+    BOOST_CHECK_EQUAL(compareRecords(store, parser_dense), 0);
+    BOOST_CHECK_LE(compareRecords(store_quantized, parser_dense), tol_quantization * (1 + 1e-9));
+    BOOST_CHECK_GT(compareRecords(store_quantized, parser_dense), 0);
+    BOOST_CHECK_LT(store_quantized.getMemoryUsage(), store.getMemoryUsage());
+
+    std::size_t bytes_dense = 0;
+    for (const Eigen::Ref<const DataParser::Data> &experiments : parser_dense.getDataByJoint())
+        bytes_dense += experiments.size() * sizeof(double);
+    BOOST_CHECK_LT(2 * store.getMemoryUsage(), bytes_dense);
+
+    // Decoding may start from any keyframe
+    BOOST_REQUIRE_GT(store.getNKeyframes(), 2);
+    BOOST_CHECK_EQUAL(compareRecords(store, parser_dense, 2, 2 * keyframe_interval), 0);
+
+    // Identification streams the store and matches the dense results
+    Identification ident_dense(3), ident_compact(3), ident_quantized(3);
+    BOOST_REQUIRE(ident_dense.setData(parser_dense));
+    BOOST_REQUIRE(ident_compact.setData(parser_compact));
+    BOOST_REQUIRE(ident_quantized.setData(parser_quantized));
+    for (bool start_from_last : {false, true})
+    {
+        for (bool refine : {false, true})
+        {
+            // The refinement sums the store in recording order, so only rounding may differ
+            auto axes_dense = ident_dense.identifyAxes(start_from_last, refine);
+            if (refine)
+                BOOST_CHECK(compareMatrices(ident_compact.identifyAxes(start_from_last, refine), axes_dense, 1e-12));
+            else
+                BOOST_CHECK(ident_compact.identifyAxes(start_from_last, refine) == axes_dense);
+            BOOST_CHECK(compareMatrices(ident_quantized.identifyAxes(start_from_last, refine), axes_dense, 1e-3));
+        }
+    }
+#ifdef __GLIBC__
+    Identification::Workspace workspace;
+    ident_compact.identifyAxes(workspace, false, true);
+    unsigned long n_allocations_before = n_allocations;
+    ident_compact.identifyAxes(workspace, false, true);
+    BOOST_CHECK_EQUAL(n_allocations - n_allocations_before, 0);
+#endif
+    auto axes_refined = ident_dense.identifyAxes(false, true);
+    BOOST_CHECK_SMALL(ident_compact.computeResidual(axes_refined) - ident_dense.computeResidual(axes_refined), 1e-12);
+
+    // Followed files extend the store incrementally
+    const std::string file_follow = "compact_store_test.txt";
+    std::ifstream stream("../tests/panda.txt", std::ios_base::binary);
+    const std::string contents((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    DataParser parser_follow;
+    parser_follow.setFilter( {3,4,5} );
+    parser_follow.setDelimiter('\t');
+    parser_follow.setStorageMask(DataParser::Storage::COMPACT);
+    parser_follow.setCompactStorage(0, keyframe_interval);
+    for (std::size_t size : {contents.size() / 3, 2 * contents.size() / 3, contents.size()})
+    {
+        writeFile(file_follow, contents.substr(0, size));
+        parser_follow.followFile(file_follow);
+    }
+    BOOST_CHECK_EQUAL(parser_follow.getExperimentStore().getNRecords(), store.getNRecords());
+    BOOST_CHECK_EQUAL(compareRecords(parser_follow.getExperimentStore(), parser_dense), 0);
+    std::remove(file_follow.c_str());
+}
+
+BOOST_AUTO_TEST_CASE( workspace_test )
+{
+    DataParser parser;
+    parser.setDelimiter('\t');
+    BOOST_REQUIRE_MESSAGE(parser.readFile("../tests/random_data.txt"),
+        "File ../tests/random_data.txt not found... Some tests might have been skipped!"
+    );
+    Identification ident(parser.getNJoints());
+    ident.setData(parser);
+
+    std::vector<Eigen::Matrix<double, 3, Eigen::Dynamic>> answers;
+    for (bool refine : {false, true})
+        for (bool start_from_last : {false, true})
+            answers.push_back(ident.identifyAxes(start_from_last, refine));
+
+    // Every thread shares the identification object and reuses its own workspace,
+    // once to warm it up and once to check that it does not allocate memory anymore
+    const unsigned int n_threads = 4, n_repetitions = 2;
+    std::vector<bool> same_answers(n_threads, true);
+    std::vector<unsigned long> allocations(n_threads, 0);
+    std::vector<std::thread> threads;
+    for (unsigned int k = 0; k < n_threads; ++k)
+    {
+        threads.emplace_back([&, k] ()
+        {
+            Identification::Workspace workspace;
+            for (unsigned int repetition = 0; repetition < n_repetitions; ++repetition)
+            {
+#ifdef __GLIBC__
+                unsigned long n_allocations_before = n_allocations;
+#endif
+                unsigned int ind_answer = 0;
+                for (bool refine : {false, true})
+                    for (bool start_from_last : {false, true})
+                        same_answers[k] = same_answers[k] && (ident.identifyAxes(workspace, start_from_last, refine)
+                            - answers[ind_answer++]).cwiseAbs().maxCoeff() <= 1e-9;
+#ifdef __GLIBC__
+                // The first repetition warms the workspace up
+                if (repetition > 0)
+                    allocations[k] += n_allocations - n_allocations_before;
+#endif
+            }
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+
+    for (unsigned int k = 0; k < n_threads; ++k)
+    {
+        BOOST_CHECK_MESSAGE(same_answers[k], "Concurrent identification differs from the sequential one!");
+        BOOST_CHECK_MESSAGE(allocations[k] == 0,
+            "Identification allocated memory " << allocations[k] << " times with a warmed-up workspace!");
+    }
+}
+
+// Serial chain with random axes whose orientation is measured with noise
+class ChainSimulator
+{
+private:
+    Eigen::Matrix<double, 3, Eigen::Dynamic> axes;
+    std::mt19937 generator;
+    std::normal_distribution<double> noise;
+
+public:
+    ChainSimulator(unsigned int n_joints, unsigned int seed, double noise_std) :
+        axes(3, n_joints), generator(seed), noise(0, noise_std)
+    {
+        std::normal_distribution<double> normal;
+        for (unsigned int k = 0; k < n_joints; ++k)
+            axes.col(k) = Eigen::Vector3d(normal(generator), normal(generator), normal(generator)).normalized();
+    }
+
+    const Eigen::Matrix<double, 3, Eigen::Dynamic> & getAxes() const
+    {
+        return axes;
+    }
+
+    std::mt19937 & getGenerator()
+    {
+        return generator;
+    }
+
+    Eigen::RowVectorXd measure(const Eigen::VectorXd &theta)
+    {
+        Eigen::Matrix3d R = Eigen::Matrix3d::Identity();
+        for (unsigned int k = 0; k < axes.cols(); ++k)
+            R = R * HelperFunctions::rotAngleAxis<double>(theta(k), axes.col(k));
+        Eigen::Vector3d error(noise(generator), noise(generator), noise(generator));
+        if (error.norm() > 0)
+            R = R * HelperFunctions::rotAngleAxis<double>(error.norm(), error.normalized());
+        Eigen::RowVectorXd row(axes.cols() + 3);
+        row << theta.transpose(), std::atan2(R(2,1), R(2,2)), -std::asin(R(2,0)), std::atan2(R(1,0), R(0,0));
+        return row;
+    }
+};
+
+// Calibrates the simulated chain with one sweep per joint followed by planned or scripted moves,
+// returning the largest axis error
+double calibrate(ChainSimulator &simulator, unsigned int n_moves, bool planned)
+{
+    const unsigned int n_joints = simulator.getAxes().cols();
+    Eigen::VectorXd theta = Eigen::VectorXd::Zero(n_joints);
+    DataParser::Data data(1, n_joints + 3);
+    data.row(0) = simulator.measure(theta);
+    auto move = [&] (unsigned int joint, double delta_angle)
+    {
+        theta(joint) += delta_angle;
+        data.conservativeResize(data.rows() + 1, Eigen::NoChange);
+        data.row(data.rows() - 1) = simulator.measure(theta);
+    };
+    auto identify = [&] (DataParser &parser, Identification &ident) -> Eigen::Matrix<double, 3, Eigen::Dynamic>
+    {
+        parser.readData(data);
+        ident.setData(parser);
+        return ident.identifyAxes(false, true);
+    };
+    for (unsigned int k = 0; k < n_joints; ++k)
+        move(k, 0.3);
+    std::uniform_real_distribution<double> amplitude(DataParser::DEFAULT_MIN_MOVEMENT, ExcitationPlanner::DEFAULT_MAX_AMPLITUDE);
+    std::bernoulli_distribution positive;
+    for (unsigned int m = 0; m < n_moves; ++m)
+    {
+        if (planned)
+        {
+            DataParser parser;
+            Identification ident(n_joints);
+            auto axes = identify(parser, ident);
+            ExcitationPlanner planner(ident, parser);
+            auto next = planner.planNextMove(theta, axes);
+            move(next.joint, next.delta_angle);
+        }
+        else
+            move(m % n_joints, (positive(simulator.getGenerator()) ? 1 : -1) * amplitude(simulator.getGenerator()));
+    }
+    DataParser parser;
+    Identification ident(n_joints);
+    auto axes = identify(parser, ident);
+    return (axes - simulator.getAxes()).colwise().norm().maxCoeff();
+}
+
+BOOST_AUTO_TEST_CASE( planner_test )
+{
+    // Planned moves should reach, on average, the accuracy of twice as many scripted moves
+    const unsigned int n_joints = 5, n_seeds = 5;
+    const double noise_std = 1e-3;
+    for (unsigned int n_moves : {8, 16})
+    {
+        double error_planned = 0, error_scripted = 0;
+        for (unsigned int seed = 1; seed <= n_seeds; ++seed)
+        {
+            ChainSimulator simulator_planned(n_joints, seed, noise_std), simulator_scripted(n_joints, seed, noise_std);
+            error_planned += calibrate(simulator_planned, n_moves, true) / n_seeds;
+            error_scripted += calibrate(simulator_scripted, 2 * n_moves, false) / n_seeds;
+        }
+        BOOST_CHECK_MESSAGE(error_planned < error_scripted,
+            "Planned calibration with " << n_moves << " moves has mean axis error " << error_planned <<
+            ", scripted with " << 2 * n_moves << " moves has " << error_scripted);
+    }
+
+    // Limits and the minimum movement are respected, and the uncertainty decreases
+    ChainSimulator simulator(n_joints, 1, noise_std);
+    Eigen::VectorXd theta = Eigen::VectorXd::Zero(n_joints);
+    DataParser::Data data(n_joints + 1, n_joints + 3);
+    data.row(0) = simulator.measure(theta);
+    for (unsigned int k = 0; k < n_joints; ++k)
+    {
+        theta(k) += 0.3;
+        data.row(k + 1) = simulator.measure(theta);
+    }
+    DataParser parser;
+    BOOST_REQUIRE(parser.readData(data));
+    Identification ident(n_joints);
+    BOOST_REQUIRE(ident.setData(parser));
+    auto axes = ident.identifyAxes(false, true);
+
+    ExcitationPlanner planner(ident, parser);
+    planner.setJointLimits(Eigen::VectorXd::Constant(n_joints, -0.5), Eigen::VectorXd::Constant(n_joints, 0.5));
+    auto move = planner.planNextMove(theta, axes);
+    BOOST_REQUIRE(move.joint != DataParser::INDEX_INVALID);
+    BOOST_CHECK(std::abs(theta(move.joint) + move.delta_angle) <= 0.5);
+    BOOST_CHECK(std::abs(move.delta_angle) > DataParser::DEFAULT_MIN_MOVEMENT);
+    BOOST_CHECK(move.uncertainty < planner.computeUncertainty(axes));
+
+    planner.setJointLimits(theta, theta);
+    BOOST_CHECK(planner.planNextMove(theta, axes).joint == DataParser::INDEX_INVALID);
+
+    // Moves the parser could not tell apart from the drift of the other joints are never planned
+    planner.setJointLimits(Eigen::VectorXd::Constant(n_joints, -0.5), Eigen::VectorXd::Constant(n_joints, 0.5));
+    parser.setToleranceStall(0.6);
+    planner.setTolerances(parser);
+    move = planner.planNextMove(theta, axes);
+    BOOST_REQUIRE(move.joint != DataParser::INDEX_INVALID);
+    BOOST_CHECK(std::abs(move.delta_angle) > 0.6);
+    parser.setToleranceStall(ExcitationPlanner::DEFAULT_MAX_AMPLITUDE);
+    planner.setTolerances(parser);
+    BOOST_CHECK(planner.planNextMove(theta, axes).joint == DataParser::INDEX_INVALID);
+}
+
+BOOST_AUTO_TEST_CASE( robust_test )
+{
+    const unsigned int n_joints = 4, n_moves = 60, n_seeds = 5;
+    Identification::Estimator estimators[] = {Identification::Estimator::MEAN,
+        Identification::Estimator::WEIGHTED_MEAN, Identification::Estimator::HUBER};
+    // Summed axis errors over the seeds, indexed by [glitches][refine][estimator]
+    double errors[2][2][3] = {};
+    unsigned int n_rejected[2] = {0, 0}, n_glitches = 0;
+    for (unsigned int seed = 0; seed < n_seeds; ++seed)
+    {
+        ChainSimulator simulator(n_joints, seed, 1e-3);
+        std::mt19937 &generator = simulator.getGenerator();
+        std::uniform_real_distribution<double> amplitude(DataParser::DEFAULT_MIN_MOVEMENT, ExcitationPlanner::DEFAULT_MAX_AMPLITUDE);
+        std::bernoulli_distribution positive;
+        Eigen::VectorXd theta = Eigen::VectorXd::Zero(n_joints);
+        DataParser::Data data(n_moves + 1, n_joints + 3);
+        data.row(0) = simulator.measure(theta);
+        for (unsigned int m = 0; m < n_moves; ++m)
+        {
+            theta(m % n_joints) += (positive(generator) ? 1 : -1) * amplitude(generator);
+            data.row(m + 1) = simulator.measure(theta);
+        }
+        // IMU glitches corrupt the experiments that end and start at the glitched rows
+        DataParser::Data data_glitches = data;
+        std::uniform_real_distribution<double> angle(-M_PI, M_PI);
+        for (unsigned int k = 5; k < data.rows(); k += 10)
+        {
+            data_glitches.row(k).tail(3) << angle(generator), angle(generator) / 2, angle(generator);
+            n_glitches += 2;
+        }
+
+        for (unsigned int glitches = 0; glitches < 2; ++glitches)
+        {
+            DataParser parser;
+            BOOST_REQUIRE(parser.readData(glitches ? data_glitches : data));
+            Identification ident(n_joints);
+            BOOST_REQUIRE(ident.setData(parser));
+            Identification::Workspace workspace;
+            for (unsigned int refine = 0; refine < 2; ++refine)
+            {
+                for (unsigned int e = 0; e < 3; ++e)
+                {
+                    // The weighted mean only changes the starting point of the refinement
+                    if (refine && estimators[e] == Identification::Estimator::WEIGHTED_MEAN)
+                        continue;
+                    ident.setEstimator(estimators[e]);
+                    errors[glitches][refine][e] += (ident.identifyAxes(workspace, false, refine)
+                        - simulator.getAxes()).colwise().norm().maxCoeff();
+                    const std::vector<unsigned int> &rejected = workspace.getNRejected();
+                    if (estimators[e] == Identification::Estimator::HUBER && !refine)
+                        n_rejected[glitches] += std::accumulate(rejected.begin(), rejected.end(), 0u);
+                    else if (estimators[e] != Identification::Estimator::HUBER)
+                        BOOST_CHECK_EQUAL(std::accumulate(rejected.begin(), rejected.end(), 0u), 0);
+                }
+            }
+#ifdef __GLIBC__
+            // The robust estimator also runs in the workspace
+            unsigned long n_allocations_before = n_allocations;
+            ident.identifyAxes(workspace, false, true);
+            BOOST_CHECK_EQUAL(n_allocations - n_allocations_before, 0);
+#endif
+
+            // Rejected experiments are also left out when the refinement streams the compact store
+            DataParser parser_compact;
+            parser_compact.setStorageMask(DataParser::Storage::COMPACT);
+            BOOST_REQUIRE(parser_compact.readData(glitches ? data_glitches : data));
+            Identification ident_compact(n_joints);
+            BOOST_REQUIRE(ident_compact.setData(parser_compact));
+            ident_compact.setEstimator(Identification::Estimator::HUBER);
+            BOOST_CHECK(compareMatrices(ident_compact.identifyAxes(false, true), ident.identifyAxes(workspace, false, true), 1e-12));
+
+            // Thresholds below the median residual fall back to the defaults
+            auto axes_default = ident.identifyAxes(workspace);
+            ident.setEstimator(Identification::Estimator::HUBER, 0.5, 0.5);
+            BOOST_CHECK(ident.identifyAxes(workspace) == axes_default);
+            // The reweighting runs at least once, so the rejections are up to date
+            ident.setEstimator(Identification::Estimator::HUBER, Identification::DEFAULT_HUBER_THRESHOLD,
+                Identification::DEFAULT_REJECTION_THRESHOLD, 0);
+            ident.identifyAxes(workspace);
+            const std::vector<unsigned int> &rejected = workspace.getNRejected();
+            if (glitches)
+                BOOST_CHECK_GE(std::accumulate(rejected.begin(), rejected.end(), 0u), 2 * (n_moves / 10));
+        }
+    }
+    // Weighting by the size of the move tames small moves, whose measurements are noisier
+    BOOST_CHECK_LT(errors[0][0][1], 0.5 * errors[0][0][0]);
+    BOOST_CHECK_LT(errors[0][0][2], 1.5 * errors[0][0][1]);
+    BOOST_CHECK_LE(n_rejected[0], n_seeds);
+    // Glitched experiments are rejected and the axes are as accurate as without glitches
+    BOOST_CHECK_GE(n_rejected[1], n_glitches);
+    BOOST_CHECK_LE(n_rejected[1], n_glitches + n_seeds);
+    BOOST_CHECK_LT(errors[1][0][2], 0.1 * errors[1][0][0]);
+    BOOST_CHECK_LT(errors[1][0][2], 1.5 * errors[0][0][1]);
+    BOOST_CHECK_LT(errors[1][1][2], 0.1 * errors[1][1][0]);
+    BOOST_CHECK_LT(errors[1][1][2], 1.5 * errors[0][1][0]);
+}